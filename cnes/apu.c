@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <math.h>
+#include <string.h>
 #include "apu.h"
 #include "fake6502.h"
 #include "include/cnes.h"
@@ -462,6 +464,9 @@ static bool triangle_enabled = false;
 static bool noise_enabled = false;
 static bool dmc_enabled = false;
 
+audio_mode_t audio_mode = AUDIO_FULL;
+unsigned int audio_sample_rate = 44100;
+
 static void clock_linear_counters() {
 	if (triangle.linear_counter_reload_flag) {
 		triangle.linear_counter = triangle.linear_counter_reload;
@@ -555,7 +560,7 @@ uint8_t apu_read(uint16_t address) {
 }
 
 void apu_tick_triangle() {
-	if (triangle_enabled) {
+	if (triangle_enabled && audio_mode != AUDIO_OFF) {
 		triangle_tick();
 	}
 	if (dmc_enabled) {
@@ -566,7 +571,138 @@ void apu_tick_triangle() {
 static int16_t pulse_lookup_table[31];
 static int16_t tnd_lookup_table[203];
 
-void apu_tick(uint16_t scanline) {
+/***** OUTPUT RING *****/
+// Holds well over a frame of samples in every mode, the oldest samples are overwritten if the host falls behind
+
+#define AUDIO_RING_SIZE CNES_AUDIO_RING_SIZE
+
+static int16_t audio_ring[AUDIO_RING_SIZE];
+static size_t audio_ring_read = 0;
+static size_t audio_ring_write_pos = 0;
+static size_t audio_frame_samples = 0;
+static size_t audio_last_frame_samples = 0;
+
+static inline void audio_ring_write(int16_t sample) {
+	audio_ring[audio_ring_write_pos++ & (AUDIO_RING_SIZE - 1)] = sample;
+	if (audio_ring_write_pos - audio_ring_read > AUDIO_RING_SIZE) {
+		audio_ring_read++;
+	}
+	audio_frame_samples++;
+}
+
+size_t cnes_audio_read(int16_t* dst, size_t max) {
+	size_t count = audio_ring_write_pos - audio_ring_read;
+	if (count > max) count = max;
+	for (size_t i = 0; i < count; i++) {
+		dst[i] = audio_ring[audio_ring_read++ & (AUDIO_RING_SIZE - 1)];
+	}
+	return count;
+}
+
+const int16_t* cnes_audio_ring(size_t* read, size_t* write) {
+	*read = audio_ring_read;
+	*write = audio_ring_write_pos;
+	return audio_ring;
+}
+
+void cnes_audio_skip(size_t count) {
+	size_t buffered = audio_ring_write_pos - audio_ring_read;
+	audio_ring_read += count < buffered ? count : buffered;
+}
+
+size_t cnes_audio_samples_per_frame() {
+	return audio_last_frame_samples;
+}
+
+/***** BAND-LIMITED RESAMPLER *****/
+// Changes in the mixer output are added as band-limited steps at their exact time,
+// the buffer is integrated into samples at audio_sample_rate when read out (see blargg's blip_buf)
+
+#define APU_RATE_X2 1789773 // Twice the APU cycle rate, so it stays an integer
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+#define BLIP_UNIT_BITS 14
+#define BLIP_TIME_BITS 32
+#define BLIP_BASS_SHIFT 9
+#define BLIP_SIZE 4096
+
+static int32_t blip_kernel[BLIP_PHASES][BLIP_TAPS];
+static int32_t blip_buffer[BLIP_SIZE + BLIP_TAPS];
+static uint64_t blip_time = 0; // Output samples since the last read, fixed point
+static uint64_t blip_step = 0; // Output samples per APU cycle, fixed point
+static unsigned int blip_rate = 0;
+static int32_t blip_integrator = 0;
+static int32_t blip_last_mix = 0;
+
+static void blip_init_kernel() {
+	const double pi = 3.14159265358979323846;
+	for (size_t phase = 0; phase < BLIP_PHASES; phase++) {
+		double taps[BLIP_TAPS];
+		double sum = 0;
+		for (size_t i = 0; i < BLIP_TAPS; i++) {
+			// Blackman windowed sinc with the cutoff just below the output Nyquist frequency
+			double t = (double)i - (BLIP_TAPS / 2 - 1) - (double)phase / BLIP_PHASES;
+			double x = pi * 0.9 * t;
+			double sinc = x == 0 ? 1.0 : sin(x) / x;
+			double window = 0.42 + 0.5 * cos(2 * pi * t / BLIP_TAPS) + 0.08 * cos(4 * pi * t / BLIP_TAPS);
+			taps[i] = sinc * window;
+			sum += taps[i];
+		}
+		int32_t total = 0;
+		for (size_t i = 0; i < BLIP_TAPS; i++) {
+			blip_kernel[phase][i] = (int32_t)floor(taps[i] / sum * (1 << BLIP_UNIT_BITS) + 0.5);
+			total += blip_kernel[phase][i];
+		}
+		// Every step must add up to exactly one unit or the output drifts
+		blip_kernel[phase][BLIP_TAPS / 2] += (1 << BLIP_UNIT_BITS) - total;
+	}
+}
+
+static void blip_clear() {
+	memset(blip_buffer, 0, sizeof(blip_buffer));
+	blip_time = 0;
+	blip_integrator = 0;
+	blip_last_mix = 0;
+}
+
+static void blip_add_delta(int32_t delta) {
+	size_t pos = (size_t)(blip_time >> BLIP_TIME_BITS);
+	int32_t* kernel = blip_kernel[(blip_time >> (BLIP_TIME_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+	int32_t* out = &blip_buffer[pos];
+	for (size_t i = 0; i < BLIP_TAPS; i++) {
+		out[i] += kernel[i] * delta;
+	}
+}
+
+// Hands every finished sample to the host. Later steps can still touch the last BLIP_TAPS samples.
+static void blip_read_samples() {
+	size_t count = (size_t)(blip_time >> BLIP_TIME_BITS);
+	for (size_t i = 0; i < count; i++) {
+		blip_integrator += blip_buffer[i];
+		int32_t sample = blip_integrator >> BLIP_UNIT_BITS;
+		blip_integrator -= sample * (1 << (BLIP_UNIT_BITS - BLIP_BASS_SHIFT)); // Slowly remove DC
+		if (sample > INT16_MAX) sample = INT16_MAX;
+		if (sample < INT16_MIN) sample = INT16_MIN;
+		audio_ring_write((int16_t)sample);
+	}
+	memmove(blip_buffer, &blip_buffer[count], BLIP_TAPS * sizeof(int32_t));
+	memset(&blip_buffer[BLIP_TAPS], 0, count * sizeof(int32_t));
+	blip_time -= (uint64_t)count << BLIP_TIME_BITS;
+}
+
+void apu_end_frame() {
+	if (audio_mode == AUDIO_OFF) {
+		return; // Keeps the count of the last audible frame, e.g. across run-ahead
+	}
+	if (audio_mode == AUDIO_DECIMATED) {
+		blip_read_samples();
+	}
+	audio_last_frame_samples = audio_frame_samples;
+	audio_frame_samples = 0;
+}
+
+void apu_tick() {
 	switch (apu_cycle_counter) {
 		case 3728:
 			clock_envelopes();
@@ -611,6 +747,12 @@ void apu_tick(uint16_t scanline) {
 			break;
 	}
 
+	if (audio_mode == AUDIO_OFF) {
+		// Only the length counters, frame sequencer and DMC are observable by the CPU
+		apu_cycle_counter++;
+		return;
+	}
+
 	if (pulse1_enabled) {
 		pulse_tick(&pulse1, true);
 	}
@@ -621,11 +763,24 @@ void apu_tick(uint16_t scanline) {
 		noise_tick();
 	}
 
-	int16_t pulse_out = pulse_lookup_table[(size_t)pulse1.current_output + (size_t)pulse2.current_output];
-	int16_t tnd_out = tnd_lookup_table[3 * (size_t)triangle.current_output + 2 * (size_t)noise.current_output + (size_t)dmc.output_level];
-	int16_t frame_sample = pulse_out + tnd_out;
-	
-	write_audio_sample(scanline, frame_sample);
+	int32_t mix = pulse_lookup_table[(size_t)pulse1.current_output + (size_t)pulse2.current_output]
+		+ tnd_lookup_table[3 * (size_t)triangle.current_output + 2 * (size_t)noise.current_output + (size_t)dmc.output_level];
+	if (audio_mode == AUDIO_FULL) {
+		audio_ring_write((int16_t)mix);
+	} else {
+		if (blip_rate != audio_sample_rate) {
+			blip_rate = audio_sample_rate;
+			blip_step = ((uint64_t)blip_rate << (BLIP_TIME_BITS + 1)) / APU_RATE_X2;
+		}
+		if (mix != blip_last_mix) {
+			blip_add_delta(mix - blip_last_mix);
+			blip_last_mix = mix;
+		}
+		blip_time += blip_step;
+		if ((blip_time >> BLIP_TIME_BITS) >= BLIP_SIZE) {
+			blip_read_samples();
+		}
+	}
 	apu_cycle_counter++;
 }
 
@@ -638,6 +793,10 @@ void apu_reset() {
 	for (size_t i = 0; i < 203; i++) {
 		tnd_lookup_table[i] = (int16_t)((163.67 / (24329.0 / (double)i + 100)) * INT16_MAX);
 	}
+	blip_init_kernel();
+	blip_clear();
+	audio_ring_read = audio_ring_write_pos = 0;
+	audio_frame_samples = audio_last_frame_samples = 0;
 
 	triangle_reset();
 	noise_reset();
@@ -654,4 +813,38 @@ void apu_reset() {
 	triangle_enabled = false;
 	noise_enabled = false;
 	dmc_enabled = false;
-}
\ No newline at end of file
+}
+
+void apu_save_state(void* stream, stream_writer write) {
+	write(&pulse1, sizeof(pulse1), 1, stream);
+	write(&pulse2, sizeof(pulse2), 1, stream);
+	write(&triangle, sizeof(triangle), 1, stream);
+	write(&noise, sizeof(noise), 1, stream);
+	write(&dmc, sizeof(dmc), 1, stream);
+	write(&apu_cycle_counter, sizeof(apu_cycle_counter), 1, stream);
+	write(&five_step_mode, sizeof(five_step_mode), 1, stream);
+	write(&interrupt_inhibit, sizeof(interrupt_inhibit), 1, stream);
+	write(&frame_interrupt_flag, sizeof(frame_interrupt_flag), 1, stream);
+	write(&pulse1_enabled, sizeof(pulse1_enabled), 1, stream);
+	write(&pulse2_enabled, sizeof(pulse2_enabled), 1, stream);
+	write(&triangle_enabled, sizeof(triangle_enabled), 1, stream);
+	write(&noise_enabled, sizeof(noise_enabled), 1, stream);
+	write(&dmc_enabled, sizeof(dmc_enabled), 1, stream);
+}
+
+void apu_load_state(void* stream, stream_reader read) {
+	read(&pulse1, sizeof(pulse1), 1, stream);
+	read(&pulse2, sizeof(pulse2), 1, stream);
+	read(&triangle, sizeof(triangle), 1, stream);
+	read(&noise, sizeof(noise), 1, stream);
+	read(&dmc, sizeof(dmc), 1, stream);
+	read(&apu_cycle_counter, sizeof(apu_cycle_counter), 1, stream);
+	read(&five_step_mode, sizeof(five_step_mode), 1, stream);
+	read(&interrupt_inhibit, sizeof(interrupt_inhibit), 1, stream);
+	read(&frame_interrupt_flag, sizeof(frame_interrupt_flag), 1, stream);
+	read(&pulse1_enabled, sizeof(pulse1_enabled), 1, stream);
+	read(&pulse2_enabled, sizeof(pulse2_enabled), 1, stream);
+	read(&triangle_enabled, sizeof(triangle_enabled), 1, stream);
+	read(&noise_enabled, sizeof(noise_enabled), 1, stream);
+	read(&dmc_enabled, sizeof(dmc_enabled), 1, stream);
+}
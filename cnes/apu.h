@@ -2,11 +2,16 @@
 #define _APU_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "stream.h"
 
 void apu_reset();
-void apu_tick(uint16_t scanline);
+void apu_tick();
 void apu_tick_triangle();
+void apu_end_frame();
 void apu_write(uint16_t address, uint8_t value);
 uint8_t apu_read(uint16_t address);
+void apu_save_state(void* stream, stream_writer write);
+void apu_load_state(void* stream, stream_reader read);
 
 #endif
\ No newline at end of file
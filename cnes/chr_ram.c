@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "include/cnes.h"
+
+// Alone in its file so that a host with its own get_8k_chr_ram never pulls it in
+
+static uint8_t* chr_ram = NULL;
+
+uint8_t* get_8k_chr_ram(uint8_t num_8k_chunks) {
+	free(chr_ram);
+	chr_ram = (uint8_t*)calloc(8192, num_8k_chunks);
+	return chr_ram;
+}
@@ -1,177 +1,132 @@
 #include <stdint.h>
-#include <string.h>
-#include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 
-#include "fake6502.h"
-
-uint16_t disassembler_offset;
-
-static void read8() {
-	uint8_t value = read6502(disassembler_offset++);
-	printf("$%02X", value);
-}
-
-static void read16() {
-	uint16_t lo = (uint16_t)read6502(disassembler_offset++);
-	uint16_t hi = (uint16_t)read6502(disassembler_offset++);
-	printf("$%04X", (hi << 8) | lo);
-}
-
-static void zeropage_x() {
-	printf("("); read8(); printf(",X)");
-}
-
-static void zeropage() {
-	read8();
-}
-
-static void immediate() {
-	printf("#"); read8();
-}
-
-static void absolute() {
-	read16();
-}
-
-static void indirect() {
-	printf("("); read16(); printf(")");
-}
-
-static void zeropage_y() {
-	printf("("); read8(); printf("),Y");
-}
-
-static void zeropage_x2() {
-	read8(); printf(",X");
-}
-
-static void absolute_y() {
-	read16(); printf(",Y");
-}
-
-static void absolute_x() {
-	read16(); printf(",X");
-}
-
-static void accumulator() {
-	printf("A");
-}
+#include "include/cnes.h"
+
+typedef enum {
+	IMPLIED,
+	ACCUMULATOR,
+	IMMEDIATE,
+	ZEROPAGE,
+	ZEROPAGE_X,
+	ZEROPAGE_Y,
+	ABSOLUTE,
+	ABSOLUTE_X,
+	ABSOLUTE_Y,
+	INDIRECT,
+	INDIRECT_X,
+	INDIRECT_Y,
+	RELATIVE
+} address_mode_t;
+
+static const uint8_t operand_bytes[] = { 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 1, 1, 1 };
+
+static const char* const operand_formats[] = {
+	"", " A", " #$%02X", " $%02X", " $%02X,X", " $%02X,Y",
+	" $%04X", " $%04X,X", " $%04X,Y", " ($%04X)", " ($%02X,X)", " ($%02X),Y", " $%04X"
+};
+
+// Most opcodes are aaabbbcc: cc picks the group, aaa the instruction and bbb the addressing mode
+static const char* const names[3][8] = {
+	{ NULL, "BIT", "JMP", "JMP", "STY", "LDY", "CPY", "CPX" },
+	{ "ORA", "AND", "EOR", "ADC", "STA", "LDA", "CMP", "SBC" },
+	{ "ASL", "ROL", "LSR", "ROR", "STX", "LDX", "DEC", "INC" }
+};
+
+// Bit bbb is set for the addressing modes each instruction has
+static const uint8_t valid_modes[3][8] = {
+	{ 0x00, 0x0A, 0x08, 0x08, 0x2A, 0xAB, 0x0B, 0x0B },
+	{ 0xFF, 0xFF, 0xFF, 0xFF, 0xFB, 0xFF, 0xFF, 0xFF },
+	{ 0xAE, 0xAE, 0xAE, 0xAE, 0x2A, 0xAB, 0xAA, 0xAA }
+};
+
+static const address_mode_t group_modes[2][8] = {
+	{ INDIRECT_X, ZEROPAGE, IMMEDIATE, ABSOLUTE, INDIRECT_Y, ZEROPAGE_X, ABSOLUTE_Y, ABSOLUTE_X },
+	{ IMMEDIATE, ZEROPAGE, ACCUMULATOR, ABSOLUTE, IMPLIED, ZEROPAGE_X, IMPLIED, ABSOLUTE_X }
+};
+
+// The single byte instructions and the ones that don't follow the pattern
+static const char* special(uint8_t opcode, address_mode_t* mode) {
+	*mode = IMPLIED;
+	switch (opcode) {
+		case 0x00: return "BRK";
+		case 0x08: return "PHP";
+		case 0x18: return "CLC";
+		case 0x28: return "PLP";
+		case 0x38: return "SEC";
+		case 0x40: return "RTI";
+		case 0x48: return "PHA";
+		case 0x58: return "CLI";
+		case 0x60: return "RTS";
+		case 0x68: return "PLA";
+		case 0x78: return "SEI";
+		case 0x88: return "DEY";
+		case 0x8A: return "TXA";
+		case 0x98: return "TYA";
+		case 0x9A: return "TXS";
+		case 0xA8: return "TAY";
+		case 0xAA: return "TAX";
+		case 0xB8: return "CLV";
+		case 0xBA: return "TSX";
+		case 0xC8: return "INY";
+		case 0xCA: return "DEX";
+		case 0xD8: return "CLD";
+		case 0xE8: return "INX";
+		case 0xEA: return "NOP";
+		case 0xF8: return "SED";
+		case 0x20: *mode = ABSOLUTE; return "JSR";
+	}
 
-static void relative() {
-	int d = (int)read6502(disassembler_offset++);
-	if (d & 0x80) {
-		d = -(d ^ 0xFF);
+	*mode = RELATIVE;
+	switch (opcode) {
+		case 0x10: return "BPL";
+		case 0x30: return "BMI";
+		case 0x50: return "BVC";
+		case 0x70: return "BVS";
+		case 0x90: return "BCC";
+		case 0xB0: return "BCS";
+		case 0xD0: return "BNE";
+		case 0xF0: return "BEQ";
 	}
-	printf("%d", d);
+	return NULL;
 }
 
-void disassemble() {
-	uint8_t opcode = read6502(disassembler_offset++);
+uint8_t cnes_disassemble(uint16_t pc, const uint8_t bytes[3], char* text, size_t size) {
+	uint8_t opcode = bytes[0];
 	uint8_t aaa = opcode >> 5;
 	uint8_t bbb = (opcode >> 2) & 7;
 	uint8_t cc = opcode & 3;
 
-	switch (opcode) {
-		case 0x00: printf("BRK"); break;
-		case 0x08: printf("PHP"); break;
-		case 0x10: printf("BPL "); relative(); break;
-		case 0x18: printf("CLC"); break;
-		case 0x20: printf("JSR "); absolute(); break;
-		case 0x28: printf("PLP"); break;
-		case 0x30: printf("BMI "); relative(); break;
-		case 0x38: printf("SEC"); break;
-		case 0x40: printf("RTI"); break;
-		case 0x48: printf("PHA"); break;
-		case 0x50: printf("BVC "); relative(); break;
-		case 0x58: printf("CLI"); break;
-		case 0x60: printf("RTS"); break;
-		case 0x68: printf("PLA"); break;
-		case 0x70: printf("BVS "); relative(); break;
-		case 0x78: printf("SEI"); break;
-		case 0x88: printf("DEY"); break;
-		case 0x8A: printf("TXA"); break;
-		case 0x90: printf("BCC "); relative(); break;
-		case 0x98: printf("TYA"); break;
-		case 0x9A: printf("TXS"); break;
-		case 0xA8: printf("TAY"); break;
-		case 0xAA: printf("TAX"); break;
-		case 0xB0: printf("BCS "); relative(); break;
-		case 0xB8: printf("CLV"); break;
-		case 0xBA: printf("TSX"); break;
-		case 0xC8: printf("INY"); break;
-		case 0xCA: printf("DEX"); break;
-		case 0xD0: printf("BNE "); relative(); break;
-		case 0xD8: printf("CLD"); break;
-		case 0xE8: printf("INX"); break;
-		case 0xEA: printf("NOP"); break;
-		case 0xF0: printf("BEQ "); relative(); break;
-		case 0xF8: printf("SED"); break;
-		default:
-			switch (cc) {
-				case 0:
-					switch (aaa) {
-						case 1: printf("BIT "); break;
-						case 2: printf("JMP "); break;
-						case 3: printf("JMP "); break;
-						case 4: printf("STY "); break;
-						case 5: printf("LDY "); break;
-						case 6: printf("CPY "); break;
-						case 7: printf("CPX "); break;
-					}
-					switch (bbb) {
-						case 0: immediate(); break;
-						case 1: zeropage(); break;
-						case 3: aaa == 3 ? indirect() : absolute(); break;
-						case 5: zeropage_x2(); break;
-						case 7: absolute_x(); break;
-					}
-					break;
-				case 1:
-					switch (aaa) {
-						case 0: printf("ORA "); break;
-						case 1: printf("AND "); break;
-						case 2: printf("EOR "); break;
-						case 3: printf("ADC "); break;
-						case 4: printf("STA "); break;
-						case 5: printf("LDA "); break;
-						case 6: printf("CMP "); break;
-						case 7: printf("SBC "); break;
-					}
-					switch (bbb) {
-						case 0: zeropage_x(); break;
-						case 1: zeropage(); break;
-						case 2: immediate(); break;
-						case 3: absolute(); break;
-						case 4: zeropage_y(); break;
-						case 5: zeropage_x2(); break;
-						case 6: absolute_y(); break;
-						case 7: absolute_x(); break;
-					}
-					break;
-				case 2:
-					switch (aaa) {
-						case 0: printf("ASL "); break;
-						case 1: printf("ROL"); break;
-						case 2: printf("LSR "); break;
-						case 3: printf("ROR "); break;
-						case 4: printf("STX "); break;
-						case 5: printf("LDX "); break;
-						case 6: printf("DEC "); break;
-						case 7: printf("INC "); break;
-					}
-					switch (bbb) {
-						case 0: immediate(); break;
-						case 1: zeropage(); break;
-						case 2: accumulator(); break;
-						case 3: absolute(); break;
-						case 5: aaa == 4 || aaa == 5 ? zeropage_y() : zeropage_x2(); break;
-						case 7: aaa == 5 ? absolute_y() : absolute_x(); break;
-					}
-					break;
-				default:
-					break;
-			}
+	address_mode_t mode;
+	const char* name = special(opcode, &mode);
+	if (!name && cc != 3 && (valid_modes[cc][aaa] >> bbb) & 1) {
+		name = names[cc][aaa];
+		mode = group_modes[cc != 1][bbb];
+		if (opcode == 0x6C) {
+			mode = INDIRECT;
+		} else if (mode == ZEROPAGE_X && (opcode == 0x96 || opcode == 0xB6)) {
+			mode = ZEROPAGE_Y;
+		} else if (opcode == 0xBE) {
+			mode = ABSOLUTE_Y;
+		}
+	}
+	if (!name) {
+		// Unofficial opcodes aren't decoded
+		snprintf(text, size, ".byte $%02X", opcode);
+		return 1;
+	}
+
+	unsigned int operand = bytes[1];
+	if (operand_bytes[mode] == 2) {
+		operand |= (unsigned int)bytes[2] << 8;
+	} else if (mode == RELATIVE) {
+		operand = (uint16_t)(pc + 2 + (int8_t)bytes[1]);
+	}
+
+	int length = snprintf(text, size, "%s", name);
+	if (length >= 0 && (size_t)length < size) {
+		snprintf(text + length, size - (size_t)length, operand_formats[mode], operand);
 	}
-	printf("\n");
-}
\ No newline at end of file
+	return 1 + operand_bytes[mode];
+}
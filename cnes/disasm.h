@@ -1,9 +0,0 @@
-#ifndef _DISASM_H_
-#define _DISASM_H_
-
-#include <stdint.h>
-
-extern uint16_t disassembler_offset;
-void disassemble();
-
-#endif
\ No newline at end of file
@@ -103,6 +103,7 @@
  *****************************************************/
 
 #include <stdint.h>
+#include <stddef.h>
 
  //6502 defines
 #define UNDOCUMENTED //when this is defined, undocumented opcodes are handled.
@@ -130,28 +131,21 @@
 //flag modifier macros
 #define setcarry() status |= FLAG_CARRY
 #define clearcarry() status &= (~FLAG_CARRY)
-#define setzero() status |= FLAG_ZERO
-#define clearzero() status &= (~FLAG_ZERO)
 #define setinterrupt() status |= FLAG_INTERRUPT
 #define clearinterrupt() status &= (~FLAG_INTERRUPT)
 #define setdecimal() status |= FLAG_DECIMAL
 #define cleardecimal() status &= (~FLAG_DECIMAL)
 #define setoverflow() status |= FLAG_OVERFLOW
 #define clearoverflow() status &= (~FLAG_OVERFLOW)
-#define setsign() status |= FLAG_SIGN
-#define clearsign() status &= (~FLAG_SIGN)
 
 
 //flag calculation macros
-#define zerocalc(n) {\
-    if ((n) & 0x00FF) clearzero();\
-        else setzero();\
-}
-
-#define signcalc(n) {\
-    if ((n) & 0x0080) setsign();\
-        else clearsign();\
-}
+//Z and N are not kept in status, only the last results that set them. most are overwritten
+//before anything looks, so they are worked out when a branch, push or status6502() needs them
+#define zerocalc(n) zero_result = (uint8_t)(n)
+#define signcalc(n) sign_result = (uint8_t)(n)
+#define zeroflag() (zero_result == 0)
+#define signflag() (sign_result & 0x80)
 
 #define carrycalc(n) {\
     if ((n) & 0xFF00) setcarry();\
@@ -173,12 +167,26 @@ uint8_t sp, a, x, y, status;
 size_t clockticks6502 = 0;
 uint16_t oldpc, ea, reladdr, value, result;
 uint8_t opcode, oldstatus;
+static uint8_t zero_result = 1, sign_result = 0; //Z is set when zero_result is 0, N is bit 7 of sign_result
+static uint16_t operand; //raw operand bytes of the current instruction, pc already points past them
 
 //externally supplied functions
 extern uint8_t read6502(uint16_t address);
 extern void write6502(uint16_t address, uint8_t value);
+extern uint8_t* prg_map[4]; //PRG ROM visible at $8000, $A000, $C000 and $E000
+extern void idle_sync(); //puts the registers back where they belong if idle loop iterations were skipped
 
 //a few general functions used by various other functions
+uint8_t status6502() {
+	return (status & ~(FLAG_ZERO | FLAG_SIGN)) | (zeroflag() ? FLAG_ZERO : 0) | (sign_result & FLAG_SIGN);
+}
+
+void set_status6502(uint8_t value) {
+	status = value;
+	zero_result = (value & FLAG_ZERO) ? 0 : 1;
+	sign_result = value;
+}
+
 void push16(uint16_t pushval) {
 	write6502(BASE_STACK + sp, (pushval >> 8) & 0xFF);
 	write6502(BASE_STACK + ((sp - 1) & 0xFF), pushval & 0xFF);
@@ -222,74 +230,68 @@ static void acc() { //accumulator
 }
 
 static void imm() { //immediate
-	ea = pc++;
+	ea = pc - 1;
 }
 
 static void zp() { //zero-page
-	ea = (uint16_t)read6502((uint16_t)pc++);
+	ea = operand & 0xFF;
 }
 
 static void zpx() { //zero-page,X
-	ea = ((uint16_t)read6502((uint16_t)pc++) + (uint16_t)x) & 0xFF; //zero-page wraparound
+	ea = ((operand & 0xFF) + (uint16_t)x) & 0xFF; //zero-page wraparound
 }
 
 static void zpy() { //zero-page,Y
-	ea = ((uint16_t)read6502((uint16_t)pc++) + (uint16_t)y) & 0xFF; //zero-page wraparound
+	ea = ((operand & 0xFF) + (uint16_t)y) & 0xFF; //zero-page wraparound
 }
 
 static void rel() { //relative for branch ops (8-bit immediate value, sign-extended)
-	reladdr = (uint16_t)read6502(pc++);
+	reladdr = operand & 0xFF;
 	if (reladdr & 0x80) reladdr |= 0xFF00;
 }
 
 static void abso() { //absolute
-	ea = (uint16_t)read6502(pc) | ((uint16_t)read6502(pc + 1) << 8);
-	pc += 2;
+	ea = operand;
 }
 
 static void absx() { //absolute,X
 	uint16_t startpage;
-	ea = ((uint16_t)read6502(pc) | ((uint16_t)read6502(pc + 1) << 8));
+	ea = operand;
 	startpage = ea & 0xFF00;
 	ea += (uint16_t)x;
 
 	if (startpage != (ea & 0xFF00)) { //one cycle penlty for page-crossing on some opcodes
 		penaltyaddr = 1;
 	}
-
-	pc += 2;
 }
 
 static void absy() { //absolute,Y
 	uint16_t startpage;
-	ea = ((uint16_t)read6502(pc) | ((uint16_t)read6502(pc + 1) << 8));
+	ea = operand;
 	startpage = ea & 0xFF00;
 	ea += (uint16_t)y;
 
 	if (startpage != (ea & 0xFF00)) { //one cycle penlty for page-crossing on some opcodes
 		penaltyaddr = 1;
 	}
-
-	pc += 2;
 }
 
 static void ind() { //indirect
 	uint16_t eahelp, eahelp2;
-	eahelp = (uint16_t)read6502(pc) | (uint16_t)((uint16_t)read6502(pc + 1) << 8);
+	eahelp = operand;
 	eahelp2 = (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF); //replicate 6502 page-boundary wraparound bug
 	ea = (uint16_t)read6502(eahelp) | ((uint16_t)read6502(eahelp2) << 8);
-	pc += 2;
 }
 
 static void indx() { // (indirect,X)
 	uint16_t eahelp;
-	eahelp = (uint16_t)(((uint16_t)read6502(pc++) + (uint16_t)x) & 0xFF); //zero-page wraparound for table pointer
+	eahelp = (uint16_t)(((operand & 0xFF) + (uint16_t)x) & 0xFF); //zero-page wraparound for table pointer
 	ea = (uint16_t)read6502(eahelp & 0x00FF) | ((uint16_t)read6502((eahelp + 1) & 0x00FF) << 8);
 }
 
 static void indy() { // (indirect),Y
 	uint16_t eahelp, eahelp2, startpage;
-	eahelp = (uint16_t)read6502(pc++);
+	eahelp = operand & 0xFF;
 	eahelp2 = (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF); //zero-page wraparound
 	ea = (uint16_t)read6502(eahelp) | ((uint16_t)read6502(eahelp2) << 8);
 	startpage = ea & 0xFF00;
@@ -302,13 +304,10 @@ static void indy() { // (indirect),Y
 
 static uint16_t getvalue() {
 	if (addrtable[opcode] == acc) return((uint16_t)a);
+	else if (addrtable[opcode] == imm) return(operand & 0xFF); //already fetched with the opcode
 	else return((uint16_t)read6502(ea));
 }
 
-static uint16_t getvalue16() {
-	return((uint16_t)read6502(ea) | ((uint16_t)read6502(ea + 1) << 8));
-}
-
 static void putvalue(uint16_t saveval) {
 	if (addrtable[opcode] == acc) a = (uint8_t)(saveval & 0x00FF);
 	else write6502(ea, (saveval & 0x00FF));
@@ -386,7 +385,7 @@ static void bcs() {
 }
 
 static void beq() {
-	if ((status & FLAG_ZERO) == FLAG_ZERO) {
+	if (zeroflag()) {
 		oldpc = pc;
 		pc += reladdr;
 		if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; //check if jump crossed a page boundary
@@ -399,11 +398,12 @@ static void bit() {
 	result = (uint16_t)a & value;
 
 	zerocalc(result);
-	status = (status & 0x3F) | (uint8_t)(value & 0xC0);
+	signcalc(value);
+	status = (status & ~FLAG_OVERFLOW) | (uint8_t)(value & FLAG_OVERFLOW);
 }
 
 static void bmi() {
-	if ((status & FLAG_SIGN) == FLAG_SIGN) {
+	if (signflag()) {
 		oldpc = pc;
 		pc += reladdr;
 		if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; //check if jump crossed a page boundary
@@ -412,7 +412,7 @@ static void bmi() {
 }
 
 static void bne() {
-	if ((status & FLAG_ZERO) == 0) {
+	if (!zeroflag()) {
 		oldpc = pc;
 		pc += reladdr;
 		if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; //check if jump crossed a page boundary
@@ -421,7 +421,7 @@ static void bne() {
 }
 
 static void bpl() {
-	if ((status & FLAG_SIGN) == 0) {
+	if (!signflag()) {
 		oldpc = pc;
 		pc += reladdr;
 		if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; //check if jump crossed a page boundary
@@ -432,7 +432,7 @@ static void bpl() {
 static void brk() {
 	pc++;
 	push16(pc); //push next instruction address onto stack
-	push8(status | FLAG_BREAK); //push CPU status to stack
+	push8(status6502() | FLAG_BREAK); //push CPU status to stack
 	setinterrupt(); //set interrupt flag
 	pc = (uint16_t)read6502(0xFFFE) | ((uint16_t)read6502(0xFFFF) << 8);
 }
@@ -478,8 +478,7 @@ static void cmp() {
 
 	if (a >= (uint8_t)(value & 0x00FF)) setcarry();
 	else clearcarry();
-	if (a == (uint8_t)(value & 0x00FF)) setzero();
-	else clearzero();
+	zerocalc(result);
 	signcalc(result);
 }
 
@@ -489,8 +488,7 @@ static void cpx() {
 
 	if (x >= (uint8_t)(value & 0x00FF)) setcarry();
 	else clearcarry();
-	if (x == (uint8_t)(value & 0x00FF)) setzero();
-	else clearzero();
+	zerocalc(result);
 	signcalc(result);
 }
 
@@ -500,8 +498,7 @@ static void cpy() {
 
 	if (y >= (uint8_t)(value & 0x00FF)) setcarry();
 	else clearcarry();
-	if (y == (uint8_t)(value & 0x00FF)) setzero();
-	else clearzero();
+	zerocalc(result);
 	signcalc(result);
 }
 
@@ -641,7 +638,7 @@ static void pha() {
 }
 
 static void php() {
-	push8(status | FLAG_BREAK);
+	push8(status6502() | FLAG_BREAK);
 }
 
 static void pla() {
@@ -652,7 +649,7 @@ static void pla() {
 }
 
 static void plp() {
-	status = pull8() | FLAG_CONSTANT;
+	set_status6502(pull8() | FLAG_CONSTANT);
 }
 
 static void rol() {
@@ -679,7 +676,7 @@ static void ror() {
 }
 
 static void rti() {
-	status = pull8();
+	set_status6502(pull8());
 	value = pull16();
 	pc = value;
 }
@@ -883,6 +880,27 @@ static void (*optable[256])() = {
 	/* F */      beq,  sbc,  nop,  isb,  nop,  sbc,  inc,  isb,  sed,  sbc,  nop,  isb,  nop,  sbc,  inc,  isb  /* F */
 };
 
+//operand bytes following each opcode
+static const uint8_t lentable[256] = {
+	/*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |     */
+	/* 0 */      0,    1,    0,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* 0 */
+	/* 1 */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* 1 */
+	/* 2 */      2,    1,    0,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* 2 */
+	/* 3 */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* 3 */
+	/* 4 */      0,    1,    0,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* 4 */
+	/* 5 */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* 5 */
+	/* 6 */      0,    1,    0,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* 6 */
+	/* 7 */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* 7 */
+	/* 8 */      1,    1,    1,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* 8 */
+	/* 9 */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* 9 */
+	/* A */      1,    1,    1,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* A */
+	/* B */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* B */
+	/* C */      1,    1,    1,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* C */
+	/* D */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2,  /* D */
+	/* E */      1,    1,    1,    1,    1,    1,    1,    1,    0,    1,    0,    1,    2,    2,    2,    2,  /* E */
+	/* F */      1,    1,    0,    1,    1,    1,    1,    1,    0,    2,    0,    2,    2,    2,    2,    2   /* F */
+};
+
 static const uint32_t ticktable[256] = {
 	/*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |     */
 	/* 0 */      7,    6,    2,    8,    3,    3,    5,    5,    3,    2,    2,    2,    4,    4,    6,    6,  /* 0 */
@@ -905,22 +923,37 @@ static const uint32_t ticktable[256] = {
 
 
 void nmi6502() {
+	idle_sync();
 	push16(pc);
-	push8(status);
+	push8(status6502());
 	status |= FLAG_INTERRUPT;
 	pc = (uint16_t)read6502(0xFFFA) | ((uint16_t)read6502(0xFFFB) << 8);
 }
 
 void irq6502() {
+	idle_sync();
 	push16(pc);
-	push8(status);
+	push8(status6502());
 	status |= FLAG_INTERRUPT;
 	pc = (uint16_t)read6502(0xFFFE) | ((uint16_t)read6502(0xFFFF) << 8);
 }
 
 size_t total_steps_6502 = 0;
 void step6502() {
-	opcode = read6502(pc++);
+	uint16_t window_offset = pc & 0x1FFF;
+	if (pc >= 0x8000 && window_offset < 0x1FFE) {
+		//PRG ROM, the whole instruction is inside one bank so it is read straight from it
+		const uint8_t* code = &prg_map[(pc >> 13) & 3][window_offset];
+		opcode = code[0];
+		operand = (uint16_t)code[1] | ((uint16_t)code[2] << 8);
+	} else {
+		//RAM, cartridge RAM or a bank boundary, go through the bus byte by byte
+		opcode = read6502(pc);
+		operand = 0;
+		if (lentable[opcode] >= 1) operand = read6502(pc + 1);
+		if (lentable[opcode] == 2) operand |= (uint16_t)read6502(pc + 2) << 8;
+	}
+	pc += 1 + lentable[opcode];
 	status |= FLAG_CONSTANT;
 	total_steps_6502++;
 
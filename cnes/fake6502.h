@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,9 +13,13 @@ extern "C" {
 	void step6502();
 	void reset6502();
 	uint8_t read6502(uint16_t address);
+	// The status register with Z and N worked out, status itself only holds the other flags up to date
+	uint8_t status6502();
+	void set_status6502(uint8_t value);
 
 	extern size_t total_steps_6502;
 	extern size_t clockticks6502;
+	extern uint8_t opcode;
 	extern uint16_t pc;
 	extern uint8_t sp, a, x, y, status;
 
@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "include/cnes.h"
+
+char* cnes_read_file(const char* path, size_t* size) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return NULL;
+
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (length < 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	char* data = (char*)malloc((size_t)length + 1);
+	if (data && fread(data, 1, (size_t)length, f) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	if (data && size) *size = (size_t)length;
+	return data;
+}
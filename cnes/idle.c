@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "idle.h"
+#include "ppu.h"
+#include "nes001.h"
+#include "fake6502.h"
+#include "trace.h"
+#include "include/cnes.h"
+
+// A polling loop is recorded for one iteration. If it reads at most one RAM or $2002
+// location, writes nothing and ends with the registers it started with, every
+// following iteration that reads the same value does exactly the same thing and
+// only has to be timed, not run.
+
+#define IDLE_MAX_INSTRUCTIONS 8
+#define IDLE_MAX_LOOP_BYTES 32
+
+typedef struct {
+	uint8_t a, x, y, sp, status;
+} registers_t;
+
+typedef struct {
+	uint16_t pc;
+	uint16_t next_pc;
+	registers_t after;
+	uint8_t cycles;
+} loop_instruction_t;
+
+static enum {
+	IDLE_SEARCHING, // Waiting for a short backwards jump
+	IDLE_RECORDING, // Recording one iteration of the loop
+	IDLE_RECORDED,  // Following the loop around to the instruction that reads the watched location
+	IDLE_SKIPPING   // Whole iterations are being skipped
+} idle_state = IDLE_SEARCHING;
+
+static loop_instruction_t loop[IDLE_MAX_INSTRUCTIONS];
+static size_t loop_length = 0;
+static size_t loop_position = 0;
+static size_t loop_anchor = 0; // The instruction that reads the watched location, or the first one
+static size_t loop_dots = 0;
+static size_t loop_cycles = 0;
+static registers_t loop_entry;
+
+static bool watching = false;
+static uint16_t watch_address = 0;
+static uint8_t watch_value = 0;
+
+bool idle_skip_enabled = true;
+size_t idle_skipped_cycles = 0;
+
+static registers_t current_registers() {
+	registers_t registers = { a, x, y, sp, status6502() };
+	return registers;
+}
+
+static bool same_registers(registers_t registers) {
+	return registers.a == a && registers.x == x && registers.y == y && registers.sp == sp && registers.status == status6502();
+}
+
+static bool is_branch(uint8_t op) {
+	return (op & 0x1F) == 0x10;
+}
+
+static bool reads_memory(uint8_t op) {
+	switch (op) {
+		case 0xA5: case 0xAD: // LDA
+		case 0xA6: case 0xAE: // LDX
+		case 0xA4: case 0xAC: // LDY
+		case 0x24: case 0x2C: // BIT
+		case 0xC5: case 0xCD: // CMP
+		case 0xE4: case 0xEC: // CPX
+		case 0xC4: case 0xCC: // CPY
+		case 0x25: case 0x2D: // AND
+		case 0x05: case 0x0D: // ORA
+		case 0x45: case 0x4D: // EOR
+			return true;
+	}
+	return false;
+}
+
+static bool registers_only(uint8_t op) {
+	switch (op) {
+		case 0xA9: case 0xA2: case 0xA0: // LDA, LDX, LDY #
+		case 0x29: case 0x09: case 0x49: // AND, ORA, EOR #
+		case 0xC9: case 0xE0: case 0xC0: // CMP, CPX, CPY #
+		case 0xAA: case 0xA8: case 0x8A: case 0x98: // TAX, TAY, TXA, TYA
+		case 0x18: case 0x38: case 0xEA: // CLC, SEC, NOP
+		case 0x4C: // JMP abs
+			return true;
+	}
+	return is_branch(op);
+}
+
+static size_t dots(uint8_t cycles) {
+	return (size_t)cycles * 3 + 1;
+}
+
+static void start_recording() {
+	idle_state = IDLE_RECORDING;
+	loop_length = 0;
+	loop_anchor = 0;
+	loop_dots = 0;
+	loop_cycles = 0;
+	loop_entry = current_registers();
+	watching = false;
+}
+
+// Checks the instruction at pc before it runs, false if it can't be part of an idle loop
+static bool record_read(uint8_t op) {
+	if (!reads_memory(op)) {
+		return registers_only(op);
+	}
+
+	uint16_t address = peek6502(pc + 1);
+	if ((op & 0x0F) >= 0x0C) {
+		address |= (uint16_t)peek6502(pc + 2) << 8;
+	}
+
+	if (address >= 0x8000) {
+		// PRG ROM, nothing in the loop can switch banks
+		return true;
+	}
+	if (watching) {
+		return false;
+	}
+
+	uint8_t value = peek6502(address);
+	if (address >= 0x2000 && address < 0x4000 && (address & 7) == 2) {
+		// $2002 may only be watched while reading it doesn't clear vblank
+		if (value & 0x80) return false;
+	} else if (address >= 0x2000) {
+		return false;
+	}
+
+	watching = true;
+	watch_address = address;
+	watch_value = value;
+	loop_anchor = loop_length;
+	return true;
+}
+
+static void record_step(uint16_t instruction_pc) {
+	loop_instruction_t* instruction = &loop[loop_length++];
+	instruction->pc = instruction_pc;
+	instruction->next_pc = pc;
+	instruction->after = current_registers();
+	instruction->cycles = (uint8_t)clockticks6502;
+	loop_dots += dots(instruction->cycles);
+	loop_cycles += instruction->cycles;
+
+	if (pc != loop[0].pc) {
+		if (loop_length == IDLE_MAX_INSTRUCTIONS) idle_state = IDLE_SEARCHING;
+		return;
+	}
+
+	// One iteration done, it only repeats itself exactly if it ends where it started
+	if (same_registers(loop_entry)) {
+		idle_state = IDLE_RECORDED;
+		loop_position = 0;
+	} else {
+		start_recording();
+	}
+}
+
+static registers_t before_anchor() {
+	return loop_anchor == 0 ? loop_entry : loop[loop_anchor - 1].after;
+}
+
+static bool watch_unchanged() {
+	return !watching || peek6502(watch_address) == watch_value;
+}
+
+void idle_step() {
+	if (idle_state == IDLE_SKIPPING) {
+		idle_skipped_cycles += loop_cycles;
+		if (watch_unchanged()) {
+			cpu_timer = loop_dots - 1;
+			return;
+		}
+		// The registers are exactly those the loop had before the anchor, so it simply runs on from here
+		idle_state = IDLE_SEARCHING;
+	} else if (idle_state == IDLE_RECORDED) {
+		if (pc != loop[loop_position].pc) {
+			idle_state = IDLE_SEARCHING;
+		} else if (loop_position == loop_anchor) {
+			if (same_registers(before_anchor()) && watch_unchanged()) {
+				idle_state = IDLE_SKIPPING;
+				cpu_timer = loop_dots - 1;
+				return;
+			}
+			idle_state = IDLE_SEARCHING;
+		} else {
+			loop_position++;
+		}
+	}
+
+	uint16_t instruction_pc = pc;
+	if (idle_state == IDLE_RECORDING && !record_read(peek6502(pc))) {
+		idle_state = IDLE_SEARCHING;
+	}
+
+	if (trace_enabled) {
+		trace_step();
+	} else {
+		step6502();
+	}
+	cpu_timer = clockticks6502 + clockticks6502 + clockticks6502;
+
+	if (idle_state == IDLE_RECORDING) {
+		record_step(instruction_pc);
+	} else if (idle_state == IDLE_SEARCHING && idle_skip_enabled && !trace_enabled) {
+		bool jumped = opcode == 0x4C || (is_branch(opcode) && pc != (uint16_t)(instruction_pc + 2));
+		if (jumped && pc <= instruction_pc && instruction_pc - pc < IDLE_MAX_LOOP_BYTES) {
+			start_recording();
+			loop[0].pc = pc;
+		}
+	}
+}
+
+void idle_sync() {
+	if (idle_state != IDLE_SKIPPING) {
+		idle_state = IDLE_SEARCHING;
+		return;
+	}
+	idle_state = IDLE_SEARCHING;
+
+	// Find the instruction the CPU would be in the middle of by now
+	size_t elapsed = loop_dots - 1 - cpu_timer;
+	size_t index = loop_anchor;
+	size_t start = 0;
+	while (start + dots(loop[index].cycles) <= elapsed) {
+		start += dots(loop[index].cycles);
+		index = (index + 1) % loop_length;
+	}
+	idle_skipped_cycles += elapsed / 3;
+
+	loop_instruction_t* instruction = &loop[index];
+	pc = instruction->next_pc;
+	a = instruction->after.a;
+	x = instruction->after.x;
+	y = instruction->after.y;
+	sp = instruction->after.sp;
+	set_status6502(instruction->after.status);
+	clockticks6502 = instruction->cycles;
+	cpu_timer = (size_t)instruction->cycles * 3 - (elapsed - start);
+}
+
+void idle_reset() {
+	idle_state = IDLE_SEARCHING;
+}
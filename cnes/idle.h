@@ -0,0 +1,15 @@
+#ifndef _IDLE_H_
+#define _IDLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Runs the CPU for one instruction when cpu_timer has run out, skipping whole
+// iterations of polling loops that can't see anything change
+void idle_step();
+// Puts the CPU registers and cpu_timer where they would be without skipping
+void idle_sync();
+void idle_reset();
+
+#endif
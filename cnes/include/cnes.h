@@ -1,10 +1,13 @@
 #ifndef _CNES_H_
 #define _CNES_H_
 
+#include <stdint.h>
+#include <stdbool.h>
 #include "../stream.h"
 
 #define CNES_LOAD_NO_ERR 0
 #define CNES_LOAD_MAPPER_NOT_SUPPORTED 1
+#define CNES_LOAD_NOT_INES 2
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,17 +19,121 @@ extern "C" {
 		uint8_t b;
 	} pixformat_t;
 
+	typedef enum {
+		AUDIO_FULL,      // One sample for every APU cycle (~894 kHz)
+		AUDIO_DECIMATED, // Band-limited and resampled to audio_sample_rate
+		AUDIO_OFF        // No waveforms are generated, only state visible to the CPU is emulated
+	} audio_mode_t;
+
 	extern pixformat_t framebuffer[256 * 240];
+	// One bit per 8x8 tile that the last tick_frame changed, bit n of row y is the tile at (8n, 8y)
+	extern uint32_t framebuffer_dirty[30];
+	// Palette index in bits 0-5 and the emphasis bits in 6-8 for every pixel, what the NTSC filter works from
+	extern uint16_t framebuffer_indices[256 * 240];
+	// Where the color subcarrier starts in the last drawn frame, it moves every frame
+	extern uint8_t framebuffer_phase;
 	extern uint8_t buttons_down[2];
-	extern void write_audio_sample(int scanline, int16_t sample);
+	// The 2 KB of CPU RAM, where games keep their variables. For reading, writes from
+	// outside the CPU aren't seen by cnes_state_hash
+	extern uint8_t cpuram[2048];
+	// The cartridge's PRG RAM at $6000, NULL when it has none
+	extern uint8_t* cartridge_ram;
+	extern size_t cartridge_ram_size;
+	// Copies out which bytes of cpuram and cartridge_ram the CPU wrote since the last call and
+	// starts over, one bit per byte: bit (a & 7) of byte a / 8. The arrays take 256 and 1024
+	// bytes, either can be NULL. load_state and reset_machine count as writing everything,
+	// tick_frame_runahead only as what its real frame wrote.
+	// Returns false, leaving them alone, when cnes was built without CNES_WRITE_TRACKING
+	bool cnes_take_ram_writes(uint8_t* cpuram_written, uint8_t* cartridge_ram_written);
+	// When false, tick_frame leaves framebuffer untouched but keeps every other side effect
+	extern bool video_output_enabled;
+	// Number of threads drawing pixels while tick_frame goes on with the following lines, 0 draws
+	// them on the calling thread. The framebuffer is complete when tick_frame returns either way
+	// and the output is identical
+	extern unsigned int video_threads;
+	// When both are set, tick_frame draws a gray_width x gray_height grayscale image into
+	// framebuffer_gray instead of framebuffer and framebuffer_indices, which it leaves alone.
+	// Each pixel averages the luminance of the area it covers. At most 256 x 240
+	extern unsigned int gray_width;
+	extern unsigned int gray_height;
+	extern uint8_t framebuffer_gray[256 * 240];
+	extern audio_mode_t audio_mode;
+	extern unsigned int audio_sample_rate;
+	// Skips iterations of polling loops that only wait on RAM or $2002, results are identical either way
+	extern bool idle_skip_enabled;
+	// CPU cycles that were skipped instead of emulated so far
+	extern size_t idle_skipped_cycles;
+	// Called by load_ines for cartridges with CHR RAM. cnes has a default that allocates it,
+	// a host that defines its own keeps the default out of the link
 	extern uint8_t* get_8k_chr_ram(uint8_t num_8k_chunks);
+	// Reads a whole file into memory for the caller to free, NULL when it can't. size may be NULL
+	char* cnes_read_file(const char* path, size_t* size);
 
+	// Whether the size bytes at data are a whole iNES file load_ines can play, without
+	// touching the loaded cartridge. load_ines trusts the sizes in the header, check first
+	int cnes_check_ines(const char* data, size_t size);
 	int load_ines(const char* data);
 	void reset_machine();
 	void tick_frame();
+	// Emulates one frame, then peeks the given number of frames ahead with the same input and shows the last one
+	void tick_frame_runahead(uint8_t frames);
+
+	// Copies up to max buffered samples to dst and returns how many were copied
+	size_t cnes_audio_read(int16_t* dst, size_t max);
+	// Number of samples the last tick_frame produced
+	size_t cnes_audio_samples_per_frame();
+	#define CNES_AUDIO_RING_SIZE 32768
+	// The buffered samples without copying them: they are at positions read .. write - 1, each
+	// at ring[position % CNES_AUDIO_RING_SIZE]. cnes_audio_skip consumes them like cnes_audio_read
+	const int16_t* cnes_audio_ring(size_t* read, size_t* write);
+	void cnes_audio_skip(size_t count);
+
+	#define CNES_NTSC_WIDTH 602
+	// Builds the NTSC filter tables (about 600 KB), needed once before cnes_ntsc_render
+	bool cnes_ntsc_init();
+	// Decodes lines of framebuffer_indices through a simulated composite signal into output,
+	// CNES_NTSC_WIDTH pixels per line. Separate line ranges can be rendered on separate threads
+	void cnes_ntsc_render(pixformat_t* output, size_t first_line, size_t line_count);
 
 	void save_state(void* stream, stream_writer write);
 	void load_state(void* stream, stream_reader read);
+	// The bytes save_state writes, the same for every state of the loaded ROM
+	size_t cnes_state_size();
+	// save_state into and load_state from a buffer of cnes_state_size bytes
+	void cnes_save_state_to(uint8_t* buffer);
+	void cnes_load_state_from(const uint8_t* buffer);
+	// 64-bit hash of everything save_state writes, equal states hash the same. RAM is hashed
+	// in pages that are only hashed again once written, so calling it every frame costs
+	// microseconds; after load_state or reset_machine the next call hashes everything
+	uint64_t cnes_state_hash();
+
+	// An instruction the CPU ran, as it was about to run it
+	typedef struct {
+		uint64_t cycle;   // CPU cycles since the trace started, OAM DMA included
+		uint16_t pc;
+		uint8_t bytes[3]; // The opcode and the two bytes after it
+		uint8_t a, x, y, sp, p;
+		int16_t scanline;
+		uint16_t dot;
+	} cnes_trace_record_t;
+
+	// Records every instruction from now on into ring, the last capacity of them at
+	// ring[i % capacity] for i up to cnes_trace_count. Polling loops aren't skipped while
+	// tracing, so a trace never misses an instruction
+	void cnes_trace_to_ring(cnes_trace_record_t* ring, size_t capacity);
+	// Records every instruction from now on, packed in blocks of up to CNES_TRACE_BLOCK_RECORDS
+	// that are written through write as they fill and by cnes_trace_stop
+	#define CNES_TRACE_BLOCK_RECORDS 4096
+	void cnes_trace_to_stream(void* stream, stream_writer write);
+	void cnes_trace_stop();
+	// Instructions recorded since the trace started
+	size_t cnes_trace_count();
+	// Unpacks the block at the start of data into records, returns the number of bytes it
+	// took or 0 when data holds less than a whole block
+	size_t cnes_trace_unpack(const uint8_t* data, size_t size, cnes_trace_record_t* records, size_t* count);
+	// Writes the instruction in bytes, found at pc, into text as something like "LDA $0200,X"
+	// and returns how many of the bytes it takes. Only the bytes are looked at, never the bus
+	uint8_t cnes_disassemble(uint16_t pc, const uint8_t bytes[3], char* text, size_t size);
 
 #ifdef __cplusplus
 }
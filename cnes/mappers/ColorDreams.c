@@ -8,9 +8,16 @@ static inline uint16_t ppu_addr_to_ciram_addr(uint16_t ppuaddr) {
 	return ciram_address;
 }
 
+static void colordreams_update_prg_map() {
+	for (size_t i = 0; i < 4; i++) {
+		prg_map[i] = &ines.prg_rom[prg_bank * 0x8000 + i * 0x2000];
+	}
+}
+
 void colordreams_reset() {
 	chr_bank = 0;
 	prg_bank = 0;
+	colordreams_update_prg_map();
 }
 
 uint8_t colordreams_ppuRead(uint16_t address) {
@@ -36,6 +43,7 @@ void colordreams_cpuWrite(uint16_t address, uint8_t value) {
 	if (address >= 0x8000) {
 		chr_bank = value >> 4;
 		prg_bank = value & 0b11;
+		colordreams_update_prg_map();
 	}
 }
 
@@ -47,4 +55,5 @@ void colordreams_save_state(void* stream, stream_writer write) {
 void colordreams_load_state(void* stream, stream_reader read) {
 	read(&chr_bank, sizeof(chr_bank), 1, stream);
 	read(&prg_bank, sizeof(prg_bank), 1, stream);
+	colordreams_update_prg_map();
 }
\ No newline at end of file
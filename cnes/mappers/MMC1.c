@@ -1,4 +1,5 @@
 #include "MMC1.h"
+#include "../statehash.h"
 
 //Control regs
 static uint8_t control_reg = 0;
@@ -16,6 +17,16 @@ static uint8_t mirroring = 0;
 static uint8_t ram[1024 * 32]; // 32KB
 
 
+static void mmc1_update_prg_map() {
+	for (size_t i = 0; i < 4; i++) {
+		if (control_reg & 0b01000) {
+			prg_map[i] = &ines.prg_rom[(i < 2 ? prg_bank_lo : prg_bank_hi) * 0x4000 + (i & 1) * 0x2000];
+		} else {
+			prg_map[i] = &ines.prg_rom[prg_bank_32 * 0x8000 + i * 0x2000];
+		}
+	}
+}
+
 void mmc1_reset() {
 	control_reg = 0x1c;
 	sr = 0;
@@ -27,6 +38,11 @@ void mmc1_reset() {
 	prg_bank_lo = 0;
 	prg_bank_hi = ines.prg_rom_size_16k_chunks - 1;
 	prg_bank_32 = 0;
+	mmc1_update_prg_map();
+	state_hash_region(STATE_PRG_RAM, ram, sizeof(ram));
+	// Only $6000-$7FFF of it is ever used
+	cartridge_ram = &ram[0x6000];
+	cartridge_ram_size = 0x2000;
 }
 
 void mmc1_save_state(void* stream, stream_writer write) {
@@ -36,6 +52,7 @@ void mmc1_save_state(void* stream, stream_writer write) {
 	write(&mirroring, sizeof(mirroring), 1, stream);
 	write(&chr_bank_4_lo, sizeof(chr_bank_4_lo), 1, stream);
 	write(&chr_bank_4_hi, sizeof(chr_bank_4_hi), 1, stream);
+	write(&char_bank_8, sizeof(char_bank_8), 1, stream);
 	write(&prg_bank_lo, sizeof(prg_bank_lo), 1, stream);
 	write(&prg_bank_hi, sizeof(prg_bank_hi), 1, stream);
 	write(&prg_bank_32, sizeof(prg_bank_32), 1, stream);
@@ -49,10 +66,12 @@ void mmc1_load_state(void* stream, stream_reader read) {
 	read(&mirroring, sizeof(mirroring), 1, stream);
 	read(&chr_bank_4_lo, sizeof(chr_bank_4_lo), 1, stream);
 	read(&chr_bank_4_hi, sizeof(chr_bank_4_hi), 1, stream);
+	read(&char_bank_8, sizeof(char_bank_8), 1, stream);
 	read(&prg_bank_lo, sizeof(prg_bank_lo), 1, stream);
 	read(&prg_bank_hi, sizeof(prg_bank_hi), 1, stream);
 	read(&prg_bank_32, sizeof(prg_bank_32), 1, stream);
 	read(ram, sizeof(ram), 1, stream);
+	mmc1_update_prg_map();
 }
 
 static inline uint16_t ppu_addr_to_ciram_addr(uint16_t ppuaddr) {
@@ -137,6 +156,10 @@ uint8_t mmc1_cpuRead(uint16_t address) {
 void mmc1_cpuWrite(uint16_t address, uint8_t value) {
 	if (address >= 0x6000 && address <= 0x7FFF) {
 		ram[address] = value;
+		state_mark_dirty(STATE_PRG_RAM, address);
+#ifdef CNES_WRITE_TRACKING
+		cartridge_ram_written[(address & 0x1FFF) >> 3] |= 1 << (address & 7);
+#endif
 	} else if (address >= 0x8000) {
 		if (value & 0x80) {
 			sr = 0;
@@ -190,6 +213,7 @@ void mmc1_cpuWrite(uint16_t address, uint8_t value) {
 				}
 				sr = 0;
 				shift_count = 0;
+				mmc1_update_prg_map();
 			}
 		}
 	}
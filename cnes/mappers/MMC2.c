@@ -24,8 +24,15 @@ static inline uint16_t mmc2_ppu_addr_to_ciram_addr(uint16_t ppuaddr) {
 }
 
 
-void mmc2_reset() {
+static void mmc2_update_prg_map() {
+	prg_map[0] = &ines.prg_rom[8192 * state.prg_rom_bank_select];
+	for (size_t i = 1; i < 4; i++) {
+		prg_map[i] = &ines.prg_rom[(size_t)ines.prg_rom_size_16k_chunks * 0x4000 - 0x8000 + i * 0x2000];
+	}
+}
 
+void mmc2_reset() {
+	mmc2_update_prg_map();
 }
 
 void mmc2_save_state(void* stream, stream_writer write) {
@@ -34,6 +41,7 @@ void mmc2_save_state(void* stream, stream_writer write) {
 
 void mmc2_load_state(void* stream, stream_reader read) {
 	read(&state, sizeof(state), 1, stream);
+	mmc2_update_prg_map();
 }
 
 uint8_t mmc2_ppuRead(uint16_t address) {
@@ -95,6 +103,7 @@ uint8_t mmc2_cpuRead(uint16_t address) {
 void mmc2_cpuWrite(uint16_t address, uint8_t value) {
 	if (address >= 0xA000 && address <= 0xAFFF) {
 		state.prg_rom_bank_select = value & 0b1111;
+		mmc2_update_prg_map();
 	} else if (address >= 0xB000 && address <= 0xBFFF) {
 		state.lower_fd_bank_select = value & 0b11111;
 	} else if (address >= 0xC000 && address <= 0xCFFF) {
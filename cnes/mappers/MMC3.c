@@ -1,6 +1,7 @@
 #include "MMC3.h"
 #include "../nes001.h"
 #include "../ppu.h"
+#include "../statehash.h"
 
 static uint8_t ram[1024 * 8]; // 8KB
 static uint8_t mirroring;
@@ -17,6 +18,12 @@ static uint16_t irq_counter;
 static bool irq_enabled;
 static bool irq_reload;
 
+static void mmc3_update_prg_map() {
+	for (size_t i = 0; i < 4; i++) {
+		prg_map[i] = &ines.prg_rom[(size_t)prg_banks[i] * 0x2000];
+	}
+}
+
 void mmc3_reset() {
 	mirroring = 0;
 	bank_to_update = 0;
@@ -37,6 +44,10 @@ void mmc3_reset() {
 	irq_counter = 0;
 	irq_enabled = false;
 	irq_reload = false;
+	mmc3_update_prg_map();
+	state_hash_region(STATE_PRG_RAM, ram, sizeof(ram));
+	cartridge_ram = ram;
+	cartridge_ram_size = sizeof(ram);
 }
 
 void mmc3_save_state(void* stream, stream_writer write) {
@@ -49,6 +60,7 @@ void mmc3_save_state(void* stream, stream_writer write) {
 	write(prg_banks, sizeof(prg_banks), 1, stream);
 	write(registers, sizeof(registers), 1, stream);
 	write(&irq_latch, sizeof(irq_latch), 1, stream);
+	write(&irq_counter, sizeof(irq_counter), 1, stream);
 	write(&irq_enabled, sizeof(irq_enabled), 1, stream);
 	write(&irq_reload, sizeof(irq_reload), 1, stream);
 }
@@ -63,8 +75,10 @@ void mmc3_load_state(void* stream, stream_reader read) {
 	read(prg_banks, sizeof(prg_banks), 1, stream);
 	read(registers, sizeof(registers), 1, stream);
 	read(&irq_latch, sizeof(irq_latch), 1, stream);
+	read(&irq_counter, sizeof(irq_counter), 1, stream);
 	read(&irq_enabled, sizeof(irq_enabled), 1, stream);
 	read(&irq_reload, sizeof(irq_reload), 1, stream);
+	mmc3_update_prg_map();
 }
 
 static inline uint16_t ppu_addr_to_ciram_addr(uint16_t ppuaddr) {
@@ -155,6 +169,10 @@ void mmc3_cpuWrite(uint16_t address, uint8_t value) {
 
 	if (address >= 0x6000 && address <= 0x7FFF) {
 		ram[address & 0x1FFF] = value;
+		state_mark_dirty(STATE_PRG_RAM, address & 0x1FFF);
+#ifdef CNES_WRITE_TRACKING
+		cartridge_ram_written[(address & 0x1FFF) >> 3] |= 1 << (address & 7);
+#endif
 	} else if (address >= 0x8000 && address <= 0x9FFF) {
 		if (address_even) {
 			bank_to_update = value & 0b111;
@@ -187,6 +205,7 @@ void mmc3_cpuWrite(uint16_t address, uint8_t value) {
 			prg_banks[0] = prg_rom_bank_mode ? (num_8k_prg_banks - 2) : (registers[6] & 0x3F);
 			prg_banks[1] = registers[7] & 0x3F;
 			prg_banks[2] = prg_rom_bank_mode ? (registers[6] & 0x3F) : (num_8k_prg_banks - 2);
+			mmc3_update_prg_map();
 		}
 	} else if (address >= 0xA000 && address <= 0xBFFF) {
 		if (address_even) {
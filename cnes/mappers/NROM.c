@@ -5,7 +5,11 @@ static inline uint16_t nrom_ppu_addr_to_ciram_addr(uint16_t ppuaddr) {
 	return ciram_address;
 }
 
-void nrom_reset() {}
+void nrom_reset() {
+	for (size_t i = 0; i < 4; i++) {
+		prg_map[i] = &ines.prg_rom[(i * 0x2000) & (ines.prg_rom_size_16k_chunks == 1 ? 0x3FFF : 0x7FFF)];
+	}
+}
 
 uint8_t nrom_ppuRead(uint16_t address) {
 	if (address & BIT_13) {
@@ -7,8 +7,16 @@ static inline uint16_t unrom_ppu_addr_to_ciram_addr(uint16_t ppuaddr) {
 
 static uint8_t selected_bank = 0;
 
+static void unrom_update_prg_map() {
+	prg_map[0] = &ines.prg_rom[selected_bank << 14];
+	prg_map[1] = &ines.prg_rom[(selected_bank << 14) | 0x2000];
+	prg_map[2] = &ines.prg_rom[(ines.prg_rom_size_16k_chunks - 1) << 14];
+	prg_map[3] = &ines.prg_rom[((ines.prg_rom_size_16k_chunks - 1) << 14) | 0x2000];
+}
+
 void unrom_reset() {
 	selected_bank = 0;
+	unrom_update_prg_map();
 }
 
 void unrom_save_state(void* stream, stream_writer write) {
@@ -17,6 +25,7 @@ void unrom_save_state(void* stream, stream_writer write) {
 
 void unrom_load_state(void* stream, stream_reader read) {
 	read(&selected_bank, sizeof(selected_bank), 1, stream);
+	unrom_update_prg_map();
 }
 
 uint8_t unrom_ppuRead(uint16_t address) {
@@ -48,5 +57,6 @@ uint8_t unrom_cpuRead(uint16_t address) {
 void unrom_cpuWrite(uint16_t address, uint8_t value) {
 	if (address >= 0x8000) {
 		selected_bank = value & 0x0F;
+		unrom_update_prg_map();
 	}
 }
@@ -7,6 +7,8 @@
 #include "apu.h"
 #include "ppu.h"
 #include "fake6502.h"
+#include "idle.h"
+#include "statehash.h"
 #include "mappers/NROM.h"
 #include "mappers/UNROM.h"
 #include "mappers/MMC1.h"
@@ -28,11 +30,20 @@ bus_read_t cartridge_ppuRead;
 bus_write_t cartridge_ppuWrite;
 
 uint8_t ciram[2048];
-static uint8_t cpuram[2048];
+uint8_t* prg_map[4];
+uint8_t* cartridge_ram = NULL;
+size_t cartridge_ram_size = 0;
+uint8_t cpuram[2048];
 static uint8_t controller_status[2] = { 0, 0 };
 
 uint8_t read6502(uint16_t address) {
-	if (address == 0x4016 || address == 0x4017) {
+	if (address >= 0x8000) {
+		// PRG ROM and RAM are checked first, they take nearly all reads
+		return prg_map[(address >> 13) & 3][address & 0x1FFF];
+	} else if (address < 0x2000) {
+		// CPU
+		return cpuram[address & 0x7FF];
+	} else if (address == 0x4016 || address == 0x4017) {
 		uint8_t controller_id = address & 1;
 		uint8_t value = controller_status[controller_id] & 1;
 		controller_status[controller_id] >>= 1;
@@ -43,24 +54,48 @@ uint8_t read6502(uint16_t address) {
 	} else if (address >= 0x4000) {
 		// Cart
 		return cartridge_cpuRead(address);
-	} else if (address >= 0x2000) {
+	} else {
 		// PPU
 		return cpu_ppu_bus_read(address & 7);
-	} else {
-		// CPU
+	}
+}
+
+// Reads like the CPU would but without side effects, anything that isn't RAM, ROM or a plain PPU register reads as 0
+uint8_t peek6502(uint16_t address) {
+	if (address >= 0x8000) {
+		return prg_map[(address >> 13) & 3][address & 0x1FFF];
+	} else if (address < 0x2000) {
 		return cpuram[address & 0x7FF];
+	} else if (address < 0x4000) {
+		return cpu_ppu_bus_peek(address & 7);
+	} else if (address >= 0x4020) {
+		return cartridge_cpuRead(address);
 	}
+	return 0;
 }
 
+static void oam_dma(uint8_t page) {
+	uint16_t address = page << 8;
+	if (address < 0x2000) {
+		ppu_oam_dma(&cpuram[address & 0x7FF]);
+	} else if (address >= 0x8000) {
+		// A page never straddles two 8 KB banks
+		ppu_oam_dma(&prg_map[(address >> 13) & 3][address & 0x1FFF]);
+	} else if (address >= 0x6000 && cartridge_ram) {
+		// The mappers with PRG RAM read it without any gating
+		ppu_oam_dma(&cartridge_ram[address & 0x1FFF]);
+	} else {
+		// Registers go through the bus so reads keep their side effects
+		for (uint16_t i = 0; i < 256; i++) {
+			cpu_ppu_bus_write(4, read6502(address | i));
+		}
+	}
+	oam_dma_pending = true;
+}
 
 void write6502(uint16_t address, uint8_t value) {
 	if (address == 0x4014) {
-		// DMA
-		uint16_t page = value << 8;
-		for (uint16_t i = 0; i < 256; i++) {
-			cpu_ppu_bus_write(4, read6502(page | i));
-		}
-		cpu_timer += 513;
+		oam_dma(value);
 	} else if (address == 0x4016) {
 		controller_status[0] = buttons_down[0];
 		controller_status[1] = buttons_down[1];
@@ -75,15 +110,47 @@ void write6502(uint16_t address, uint8_t value) {
 	} else {
 		// CPU
 		cpuram[address & 0x7FF] = value;
+		state_mark_dirty(STATE_CPURAM, address & 0x7FF);
+#ifdef CNES_WRITE_TRACKING
+		cpuram_written[(address & 0x7FF) >> 3] |= 1 << (address & 7);
+#endif
 	}
 }
 
+#ifdef CNES_WRITE_TRACKING
+uint8_t cpuram_written[2048 / 8];
+uint8_t cartridge_ram_written[0x2000 / 8];
+#endif
+
+bool cnes_take_ram_writes(uint8_t* cpuram_bits, uint8_t* cartridge_ram_bits) {
+#ifdef CNES_WRITE_TRACKING
+	if (cpuram_bits) memcpy(cpuram_bits, cpuram_written, sizeof(cpuram_written));
+	if (cartridge_ram_bits) memcpy(cartridge_ram_bits, cartridge_ram_written, sizeof(cartridge_ram_written));
+	memset(cpuram_written, 0, sizeof(cpuram_written));
+	memset(cartridge_ram_written, 0, sizeof(cartridge_ram_written));
+	return true;
+#else
+	(void)cpuram_bits;
+	(void)cartridge_ram_bits;
+	return false;
+#endif
+}
+
+// Memory that changed without the CPU writing it counts as all written
+static void mark_ram_rewritten() {
+#ifdef CNES_WRITE_TRACKING
+	memset(cpuram_written, 0xFF, sizeof(cpuram_written));
+	memset(cartridge_ram_written, 0xFF, sizeof(cartridge_ram_written));
+#endif
+}
+
 void reset_machine() {
 	for (size_t i = 0; i < 256 * 240; i++) {
 		framebuffer[i].r <<= 1;
 		framebuffer[i].g <<= 1;
 		framebuffer[i].b <<= 1;
 	}
+	memset(framebuffer_dirty, 0xFF, sizeof(framebuffer_dirty));
 
 	for (size_t i = 0; i < sizeof(ciram); i++) {
 		ciram[i] <<= 1;
@@ -98,7 +165,10 @@ void reset_machine() {
 
 	clockticks6502 = 0;
 	cpu_timer = 0;
+	idle_reset();
 	reset6502();
+	state_hash_invalidate();
+	mark_ram_rewritten();
 }
 
 
@@ -110,15 +180,41 @@ typedef struct {
 	char padding[5];
 } ines_header_t;
 
+static uint8_t ines_mapper_number(const ines_header_t* header) {
+	// DiskDude! overwrote the upper mapper nibble in old dumps
+	const char* diskdude = (const char*)&header->flags[1];
+	if (strncmp(diskdude, "DiskDude!", 9) == 0) {
+		return header->flags[0] >> 4;
+	}
+	return (header->flags[0] >> 4) | (header->flags[1] & 0xF0);
+}
+
+static int check_mapper(const ines_header_t* header) {
+	switch (ines_mapper_number(header)) {
+	case 0: case 1: case 2: case 4: case 9: case 11:
+		return CNES_LOAD_NO_ERR;
+	}
+	return CNES_LOAD_MAPPER_NOT_SUPPORTED;
+}
+
+int cnes_check_ines(const char* data, size_t size) {
+	const ines_header_t* header = (const ines_header_t*)data;
+	if (size < sizeof(ines_header_t) || memcmp(header->nes, "NES\x1A", 4) != 0) {
+		return CNES_LOAD_NOT_INES;
+	}
+	size_t needed = sizeof(ines_header_t);
+	if (header->flags[0] & 4) needed += 512;
+	needed += 16384 * (size_t)header->prg_rom_16k_chunks;
+	needed += 8192 * (size_t)header->chr_rom_8k_chunks;
+	// Without PRG ROM there are no vectors to start from
+	if (header->prg_rom_16k_chunks == 0 || needed > size) return CNES_LOAD_NOT_INES;
+	return check_mapper(header);
+}
+
 void read_ines(const char* data) {
 	ines_header_t* header = (ines_header_t*)data;
 
-	char* diskdude = (char*)&header->flags[1];
-	if (strncmp(diskdude, "DiskDude!", 9) == 0) {
-		ines.mapper_number = header->flags[0] >> 4;
-	} else {
-		ines.mapper_number = (header->flags[0] >> 4) | (header->flags[1] & 0xF0);
-	}
+	ines.mapper_number = ines_mapper_number(header);
 
 	uint8_t nFileType = 1;
 	if ((header->flags[2] & 0x0C) == 0x08) nFileType = 2;
@@ -149,9 +245,63 @@ void read_ines(const char* data) {
 	}
 }
 
+// save_state and load_state on a plain buffer
+static struct {
+	uint8_t* data;
+	size_t position;
+} buffer_stream;
+
+static size_t state_size = 0;
+
+static void measure_write(const void* data, size_t element_size, size_t element_count, void* stream) {
+	buffer_stream.position += element_size * element_count;
+}
+
+static void buffer_write(const void* data, size_t element_size, size_t element_count, void* stream) {
+	size_t length = element_size * element_count;
+	memcpy(buffer_stream.data + buffer_stream.position, data, length);
+	buffer_stream.position += length;
+}
+
+static void buffer_read(void* dest, size_t element_size, size_t element_count, void* stream) {
+	size_t length = element_size * element_count;
+	memcpy(dest, buffer_stream.data + buffer_stream.position, length);
+	buffer_stream.position += length;
+}
+
+size_t cnes_state_size() {
+	return state_size;
+}
+
+void cnes_save_state_to(uint8_t* buffer) {
+	buffer_stream.data = buffer;
+	buffer_stream.position = 0;
+	save_state(NULL, buffer_write);
+}
+
+void cnes_load_state_from(const uint8_t* buffer) {
+	buffer_stream.data = (uint8_t*)buffer;
+	buffer_stream.position = 0;
+	load_state(NULL, buffer_read);
+}
+
+// In-memory snapshot used by run-ahead, sized by load_ines
+static uint8_t* runahead_state = NULL;
+
 int load_ines(const char* data) {
+	// Nothing changes when the cartridge can't be loaded, the previous one keeps running
+	int check = check_mapper((const ines_header_t*)data);
+	if (check != CNES_LOAD_NO_ERR) return check;
 	read_ines(data);
 
+	state_hash_region(STATE_CPURAM, cpuram, sizeof(cpuram));
+	state_hash_region(STATE_CIRAM, ciram, sizeof(ciram));
+	state_hash_region(STATE_CHR_RAM, ines.is_8k_chr_ram ? ines.chr_rom : NULL, 8192);
+	// Mappers with PRG RAM set it in their reset
+	state_hash_region(STATE_PRG_RAM, NULL, 0);
+	cartridge_ram = NULL;
+	cartridge_ram_size = 0;
+
 	cartridge_scanline = NULL;
 	if (ines.mapper_number == 0) {
 		cartridge_reset = nrom_reset;
@@ -202,21 +352,30 @@ int load_ines(const char* data) {
 		cartridge_cpuWrite = colordreams_cpuWrite;
 		cartridge_ppuRead = colordreams_ppuRead;
 		cartridge_ppuWrite = colordreams_ppuWrite;
-	} else {
-		return CNES_LOAD_MAPPER_NOT_SUPPORTED;
 	}
 
 	rom_loaded = true;
 
 	reset_machine();
 
+	// Every state of one ROM takes the same size
+	buffer_stream.position = 0;
+	save_state(NULL, measure_write);
+	state_size = buffer_stream.position;
+	free(runahead_state);
+	runahead_state = (uint8_t*)malloc(state_size);
+	if (!runahead_state) exit(1);
+
 	return CNES_LOAD_NO_ERR;
 }
 
 void save_state(void* stream, stream_writer write) {
+	idle_sync();
 	write(cpuram, sizeof(cpuram), 1, stream);
 	write(ciram, sizeof(ciram), 1, stream);
-	write(&PPU_state, sizeof(PPU_state), 1, stream);
+	write(controller_status, sizeof(controller_status), 1, stream);
+	ppu_save_state(stream, write);
+	apu_save_state(stream, write);
 	
 	cartridge_save_state(stream, write);
 	
@@ -229,12 +388,16 @@ void save_state(void* stream, stream_writer write) {
 	write(&a, sizeof(a), 1, stream);
 	write(&x, sizeof(x), 1, stream);
 	write(&y, sizeof(y), 1, stream);
+	uint8_t flags = status6502();
+	write(&flags, sizeof(flags), 1, stream);
 }
 
 void load_state(void* stream, stream_reader read) {
 	read(cpuram, sizeof(cpuram), 1, stream);
 	read(ciram, sizeof(ciram), 1, stream);
-	read(&PPU_state, sizeof(PPU_state), 1, stream);
+	read(controller_status, sizeof(controller_status), 1, stream);
+	ppu_load_state(stream, read);
+	apu_load_state(stream, read);
 	
 	cartridge_load_state(stream, read);
 	
@@ -247,4 +410,46 @@ void load_state(void* stream, stream_reader read) {
 	read(&a, sizeof(a), 1, stream);
 	read(&x, sizeof(x), 1, stream);
 	read(&y, sizeof(y), 1, stream);
+	uint8_t flags;
+	read(&flags, sizeof(flags), 1, stream);
+	set_status6502(flags);
+	idle_reset();
+	state_hash_invalidate();
+	mark_ram_rewritten();
+}
+
+void tick_frame_runahead(uint8_t frames) {
+	if (frames == 0) {
+		tick_frame();
+		return;
+	}
+
+	// The real frame is the only one that is heard, the last speculative one is the only one that is seen
+	bool video = video_output_enabled;
+	audio_mode_t audio = audio_mode;
+	video_output_enabled = false;
+	tick_frame();
+
+	cnes_save_state_to(runahead_state);
+#ifdef CNES_WRITE_TRACKING
+	// Going back to the real frame isn't a write, only what it wrote counts
+	static uint8_t cpuram_real[sizeof(cpuram_written)];
+	static uint8_t cartridge_ram_real[sizeof(cartridge_ram_written)];
+	memcpy(cpuram_real, cpuram_written, sizeof(cpuram_written));
+	memcpy(cartridge_ram_real, cartridge_ram_written, sizeof(cartridge_ram_written));
+#endif
+
+	audio_mode = AUDIO_OFF;
+	for (uint8_t i = 1; i <= frames; i++) {
+		video_output_enabled = video && i == frames;
+		tick_frame();
+	}
+	audio_mode = audio;
+	video_output_enabled = video;
+
+	cnes_load_state_from(runahead_state);
+#ifdef CNES_WRITE_TRACKING
+	memcpy(cpuram_written, cpuram_real, sizeof(cpuram_written));
+	memcpy(cartridge_ram_written, cartridge_ram_real, sizeof(cartridge_ram_written));
+#endif
 }
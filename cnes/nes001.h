@@ -21,6 +21,17 @@ typedef struct {
 extern ines_t ines;
 extern bool rom_loaded;
 extern uint8_t ciram[2048];
+// The 8 KB of PRG ROM visible at $8000, $A000, $C000 and $E000, kept up to date by the mapper
+extern uint8_t* prg_map[4];
+// PRG RAM at $6000, set by mappers that have it
+extern uint8_t* cartridge_ram;
+extern size_t cartridge_ram_size;
+
+#ifdef CNES_WRITE_TRACKING
+// One bit per byte the CPU wrote since the last cnes_take_ram_writes
+extern uint8_t cpuram_written[2048 / 8];
+extern uint8_t cartridge_ram_written[0x2000 / 8];
+#endif
 
 typedef uint8_t(*bus_read_t)(uint16_t address);
 typedef void(*bus_write_t)(uint16_t address, uint8_t value);
@@ -34,6 +45,8 @@ extern bus_write_t cartridge_ppuWrite;
 extern cart_scanline cartridge_scanline;
 
 uint8_t cpu_ppu_bus_read(uint8_t address);
+uint8_t cpu_ppu_bus_peek(uint8_t address);
+uint8_t peek6502(uint16_t address);
 void cpu_ppu_bus_write(uint8_t address, uint8_t value);
 void tick_frame();
 
@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "include/cnes.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+// The PPU outputs a square wave at 12 phases per color subcarrier cycle, 8 phases per
+// pixel. Each output pixel is decoded from a box of 12 samples for luma and 24 for
+// chroma around it. That is linear in the signal, so the contribution of every
+// color at every position to the nearby output pixels is worked out up front and
+// the filter is just adding those kernels together.
+//
+// 3 input pixels (24 samples) make 7 output pixels, a kernel covers 16 of them.
+
+#define SAMPLES_PER_PIXEL 8
+#define KERNEL_WIDTH 16
+#define KERNEL_START (-4) // First output pixel of a kernel relative to the start of its group
+#define LEFT_MARGIN 2
+#define ROW_PADDING 8
+#define ROW_LENGTH (CNES_NTSC_WIDTH + 2 * ROW_PADDING)
+#define FIXED_SHIFT 5
+
+// Tuned so flat colors come out close to the regular RGB palette
+#define HUE_OFFSET 4.0
+#define SATURATION 1.06
+#define BRIGHTNESS 0.94
+#define ATTENUATION 0.746f
+
+typedef struct {
+	int16_t rgbx[KERNEL_WIDTH][4];
+} kernel_t;
+
+// [palette index with emphasis][position in group][line phase]
+static kernel_t* kernels = NULL;
+
+static float signal_sample(uint16_t index, int phase) {
+	static const float levels[8] = { 0.228f, 0.312f, 0.552f, 0.880f, 0.616f, 0.840f, 1.100f, 1.100f };
+	int color = index & 0x0F;
+	int level = (index >> 4) & 3;
+	int emphasis = index >> 6;
+
+	if (color > 13) level = 1;
+	float low = levels[level];
+	float high = levels[4 + level];
+	if (color == 0) low = high;
+	if (color > 12) high = low;
+
+	float signal = ((color + phase) % 12 < 6) ? high : low;
+	if (((emphasis & 1) && (phase % 12) < 6)
+		|| ((emphasis & 2) && ((phase + 4) % 12) < 6)
+		|| ((emphasis & 4) && ((phase + 8) % 12) < 6)) {
+		signal *= ATTENUATION;
+	}
+
+	// Black at 0, white at 1
+	return (signal - 0.312f) / (1.100f - 0.312f);
+}
+
+static void build_kernel(kernel_t* kernel, uint16_t index, int position, int line_phase) {
+	const double pi = 3.14159265358979323846;
+	for (int j = 0; j < KERNEL_WIDTH; j++) {
+		// Center of this output pixel in samples, relative to the start of the group
+		double center = (KERNEL_START + j + 0.5) * 24.0 / 7.0;
+		int middle = (int)floor(center);
+
+		double y = 0, i = 0, q = 0;
+		for (int s = 0; s < SAMPLES_PER_PIXEL; s++) {
+			int at = position * SAMPLES_PER_PIXEL + s;
+			int phase = (at + line_phase) % 12;
+			double value = signal_sample(index, phase);
+
+			if (at >= middle - 6 && at < middle + 6) {
+				y += value / 12;
+			}
+			if (at >= middle - 12 && at < middle + 12) {
+				i += value * cos(pi * (phase + HUE_OFFSET) / 6) / 24 * SATURATION;
+				q += value * sin(pi * (phase + HUE_OFFSET) / 6) / 24 * SATURATION;
+			}
+		}
+
+		double rgb[3] = {
+			y + 0.946882 * i + 0.623557 * q,
+			y - 0.274788 * i - 0.635691 * q,
+			y - 1.108545 * i + 1.709007 * q
+		};
+		for (int c = 0; c < 3; c++) {
+			kernel->rgbx[j][c] = (int16_t)lround(rgb[c] * 255 * BRIGHTNESS * (1 << FIXED_SHIFT));
+		}
+		kernel->rgbx[j][3] = 0;
+	}
+}
+
+static kernel_t* kernel_for(uint16_t index, int position, int line_phase) {
+	return &kernels[(index * 3 + position) * 3 + line_phase / 4];
+}
+
+bool cnes_ntsc_init() {
+	if (kernels) return true;
+
+	kernel_t* built = malloc(sizeof(kernel_t) * 512 * 3 * 3);
+	if (!built) return false;
+	kernels = built;
+
+	for (uint16_t index = 0; index < 512; index++) {
+		for (int position = 0; position < 3; position++) {
+			for (int line_phase = 0; line_phase < 12; line_phase += 4) {
+				build_kernel(kernel_for(index, position, line_phase), index, position, line_phase);
+			}
+		}
+	}
+	return true;
+}
+
+static void render_line(const uint16_t* indices, pixformat_t* output, int line_phase) {
+	int16_t row[ROW_LENGTH][4];
+	memset(row, 0, sizeof(row));
+
+	for (size_t x = 0; x < 256; x++) {
+		size_t group = x / 3;
+		int position = (int)(x % 3);
+		const kernel_t* kernel = kernel_for(indices[x], position, line_phase);
+		int16_t* at = row[ROW_PADDING + LEFT_MARGIN + KERNEL_START + group * 7];
+#ifdef USE_SSE2
+		for (size_t i = 0; i < KERNEL_WIDTH / 2; i++) {
+			__m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(at + i * 8)), _mm_loadu_si128((const __m128i*)&kernel->rgbx[i * 2]));
+			_mm_storeu_si128((__m128i*)(at + i * 8), sum);
+		}
+#else
+		for (size_t i = 0; i < KERNEL_WIDTH * 4; i++) {
+			at[i] += kernel->rgbx[i / 4][i % 4];
+		}
+#endif
+	}
+
+	int16_t (*visible)[4] = &row[ROW_PADDING];
+#ifdef USE_SSE2
+	for (size_t x = 0; x < CNES_NTSC_WIDTH; x += 4) {
+		__m128i lo = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)visible[x]), FIXED_SHIFT);
+		__m128i hi = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)visible[x + 2]), FIXED_SHIFT);
+		uint8_t bytes[16];
+		_mm_storeu_si128((__m128i*)bytes, _mm_packus_epi16(lo, hi));
+		for (size_t i = 0; i < 4 && x + i < CNES_NTSC_WIDTH; i++) {
+			output[x + i].r = bytes[i * 4 + 0];
+			output[x + i].g = bytes[i * 4 + 1];
+			output[x + i].b = bytes[i * 4 + 2];
+		}
+	}
+#else
+	for (size_t x = 0; x < CNES_NTSC_WIDTH; x++) {
+		uint8_t channels[3];
+		for (size_t c = 0; c < 3; c++) {
+			int value = visible[x][c] >> FIXED_SHIFT;
+			channels[c] = value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+		}
+		output[x].r = channels[0];
+		output[x].g = channels[1];
+		output[x].b = channels[2];
+	}
+#endif
+}
+
+void cnes_ntsc_render(pixformat_t* output, size_t first_line, size_t line_count) {
+	for (size_t line = first_line; line < first_line + line_count && line < 240; line++) {
+		// Each line is 341 * 8 samples long, so the subcarrier starts 4 phases later on the next one
+		int line_phase = (int)((line + framebuffer_phase) * 4 % 12);
+		render_line(&framebuffer_indices[line * 256], &output[line * CNES_NTSC_WIDTH], line_phase);
+	}
+}
@@ -1,11 +1,22 @@
 #include <stdbool.h>
+#include <string.h>
 #include "ppu.h"
 
 #include "nes001.h"
 #include "apu.h"
 #include "fake6502.h"
+#include "idle.h"
+#include "video.h"
+#include "statehash.h"
+#include "trace.h"
 #include "include/cnes.h"
 
+#ifdef _MSC_VER
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
 typedef union {
 	struct {
 		unsigned int fine_y_offset : 3;
@@ -17,24 +28,14 @@ typedef union {
 	uint16_t value;
 } NAMETABLE_Address_t;
 
-static const uint8_t palette_colors[192] =
-{
-	0x52, 0x52, 0x52, 0x01, 0x1A, 0x51, 0x0F, 0x0F, 0x65, 0x23, 0x06, 0x63, 0x36, 0x03, 0x4B, 0x40,
-	0x04, 0x26, 0x3F, 0x09, 0x04, 0x32, 0x13, 0x00, 0x1F, 0x20, 0x00, 0x0B, 0x2A, 0x00, 0x00, 0x2F,
-	0x00, 0x00, 0x2E, 0x0A, 0x00, 0x26, 0x2D, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xA0, 0xA0, 0xA0, 0x1E, 0x4A, 0x9D, 0x38, 0x37, 0xBC, 0x58, 0x28, 0xB8, 0x75, 0x21, 0x94, 0x84,
-	0x23, 0x5C, 0x82, 0x2E, 0x24, 0x6F, 0x3F, 0x00, 0x51, 0x52, 0x00, 0x31, 0x63, 0x00, 0x1A, 0x6B,
-	0x05, 0x0E, 0x69, 0x2E, 0x10, 0x5C, 0x68, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xFE, 0xFF, 0xFF, 0x69, 0x9E, 0xFC, 0x89, 0x87, 0xFF, 0xAE, 0x76, 0xFF, 0xCE, 0x6D, 0xF1, 0xE0,
-	0x70, 0xB2, 0xDE, 0x7C, 0x70, 0xC8, 0x91, 0x3E, 0xA6, 0xA7, 0x25, 0x81, 0xBA, 0x28, 0x63, 0xC4,
-	0x46, 0x54, 0xC1, 0x7D, 0x56, 0xB3, 0xC0, 0x3C, 0x3C, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xFE, 0xFF, 0xFF, 0xBE, 0xD6, 0xFD, 0xCC, 0xCC, 0xFF, 0xDD, 0xC4, 0xFF, 0xEA, 0xC0, 0xF9, 0xF2,
-	0xC1, 0xDF, 0xF1, 0xC7, 0xC2, 0xE8, 0xD0, 0xAA, 0xD9, 0xDA, 0x9D, 0xC9, 0xE2, 0x9E, 0xBC, 0xE6,
-	0xAE, 0xB4, 0xE5, 0xC7, 0xB5, 0xDF, 0xE4, 0xA9, 0xA9, 0xA9, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-};
-
 ppu_state_t PPU_state = { 0 };
 
+// The first 8 sprites in OAM order on each scanline, rebuilt when OAM or the sprite size changes
+static uint8_t line_sprites[240][8];
+static uint8_t line_sprite_count[240];
+static bool line_sprites_dirty = true;
+static uint8_t line_sprites_height = 0;
+
 void ppu_reset() {
 	for (size_t i = 0; i < 32; i++) {
 		PPU_state.palette[i] = 0;
@@ -49,6 +50,7 @@ void ppu_reset() {
 	PPU_state.V.value = 0;
 	PPU_state.T.value = 0;
 	PPU_state.ppudata_buffer = 0;
+	line_sprites_dirty = true;
 }
 
 // Frame "local" data
@@ -62,20 +64,84 @@ static uint16_t attrib_0, attrib_1;
 static NAMETABLE_Address_t nametable_address = { 0 };
 
 size_t cpu_timer = 0;
+bool oam_dma_pending = false;
 static size_t apu_timer = 0;
 
 // Public data
 int scanline = 0;
 int dot = 0;
 pixformat_t framebuffer[256 * 240];
+uint32_t framebuffer_dirty[30];
+uint16_t framebuffer_indices[256 * 240];
+uint8_t framebuffer_phase = 0;
+bool video_output_enabled = true;
+
+// The visible line being recorded for drawing, between dots 1 and 256
+static line_log_t* logging_line = NULL;
+// Set when a $2001 write turns background or sprite rendering on or off
+static bool rendering_mode_changed = false;
+
+static inline void log_line_event(uint8_t kind, uint8_t index, uint8_t value) {
+	if (logging_line && logging_line->event_count < LINE_MAX_EVENTS) {
+		line_event_t* event = &logging_line->events[logging_line->event_count++];
+		event->dot = (uint16_t)dot;
+		event->kind = kind;
+		event->index = index;
+		event->value = value;
+	}
+}
+
+void ppu_save_state(void* stream, stream_writer write) {
+	write(&PPU_state, sizeof(PPU_state), 1, stream);
+	write(&cpu_timer, sizeof(cpu_timer), 1, stream);
+	write(&apu_timer, sizeof(apu_timer), 1, stream);
+
+	write(&next_tile, sizeof(next_tile), 1, stream);
+	write(&next_pattern_lsb, sizeof(next_pattern_lsb), 1, stream);
+	write(&next_pattern_msb, sizeof(next_pattern_msb), 1, stream);
+	write(&pattern_plane_0, sizeof(pattern_plane_0), 1, stream);
+	write(&pattern_plane_1, sizeof(pattern_plane_1), 1, stream);
+	write(sprite_lsb, sizeof(sprite_lsb), 1, stream);
+	write(sprite_msb, sizeof(sprite_msb), 1, stream);
+	write(&num_sprites_on_row, sizeof(num_sprites_on_row), 1, stream);
+	write(temp_oam, sizeof(temp_oam), 1, stream);
+	write(&next_attribute, sizeof(next_attribute), 1, stream);
+	write(&attrib_0, sizeof(attrib_0), 1, stream);
+	write(&attrib_1, sizeof(attrib_1), 1, stream);
+	write(&nametable_address, sizeof(nametable_address), 1, stream);
+}
+
+void ppu_load_state(void* stream, stream_reader read) {
+	read(&PPU_state, sizeof(PPU_state), 1, stream);
+	read(&cpu_timer, sizeof(cpu_timer), 1, stream);
+	read(&apu_timer, sizeof(apu_timer), 1, stream);
+
+	read(&next_tile, sizeof(next_tile), 1, stream);
+	read(&next_pattern_lsb, sizeof(next_pattern_lsb), 1, stream);
+	read(&next_pattern_msb, sizeof(next_pattern_msb), 1, stream);
+	read(&pattern_plane_0, sizeof(pattern_plane_0), 1, stream);
+	read(&pattern_plane_1, sizeof(pattern_plane_1), 1, stream);
+	read(sprite_lsb, sizeof(sprite_lsb), 1, stream);
+	read(sprite_msb, sizeof(sprite_msb), 1, stream);
+	read(&num_sprites_on_row, sizeof(num_sprites_on_row), 1, stream);
+	read(temp_oam, sizeof(temp_oam), 1, stream);
+	read(&next_attribute, sizeof(next_attribute), 1, stream);
+	read(&attrib_0, sizeof(attrib_0), 1, stream);
+	read(&attrib_1, sizeof(attrib_1), 1, stream);
+	read(&nametable_address, sizeof(nametable_address), 1, stream);
+	line_sprites_dirty = true;
+}
 
 static inline void ppu_internal_bus_write(uint16_t address, uint8_t value) {
 	if (address >= 0x3F00 && address <= 0x3FFF) {
 		// Palette control
 		uint8_t index = address & 0xF;
-		PPU_state.palette[index == 0 ? 0 : (address & 0x1F)] = value;
+		index = index == 0 ? 0 : (address & 0x1F);
+		PPU_state.palette[index] = value;
+		log_line_event(LINE_EVENT_PALETTE, index, value);
 	} else {
 		cartridge_ppuWrite(address, value);
+		state_mark_ppu_write(address);
 	}
 }
 
@@ -90,6 +156,22 @@ static inline uint8_t ppu_internal_bus_read(uint16_t address) {
 }
 
 
+void ppu_oam_dma(const uint8_t* page) {
+	uint8_t* oam = (uint8_t*)PPU_state.OAM;
+	size_t first = 256 - PPU_state.oam_address;
+	memcpy(oam + PPU_state.oam_address, page, first);
+	memcpy(oam, page + first, PPU_state.oam_address);
+	line_sprites_dirty = true;
+}
+
+uint8_t cpu_ppu_bus_peek(uint8_t address) {
+	switch (address) {
+		case 2: return PPU_state.status.value;
+		case 4: return ((uint8_t*)PPU_state.OAM)[PPU_state.oam_address];
+	}
+	return 0;
+}
+
 uint8_t cpu_ppu_bus_read(uint8_t address) {
 	uint8_t value = 0;
 
@@ -125,13 +207,18 @@ void cpu_ppu_bus_write(uint8_t address, uint8_t value) {
 			PPU_state.T.vertical_nametable = (value >> 1) & 1;
 			break;
 		case 1:
+			if ((PPU_state.mask.value ^ value) & 0x18) {
+				rendering_mode_changed = true;
+			}
 			PPU_state.mask.value = value;
+			log_line_event(LINE_EVENT_MASK, 0, value);
 			break;
 		case 3:
 			PPU_state.oam_address = value;
 			break;
 		case 4:
 			((uint8_t*)PPU_state.OAM)[PPU_state.oam_address++] = value;
+			line_sprites_dirty = true;
 			break;
 		case 5:
 			if (PPU_state.address_latch) {
@@ -140,6 +227,7 @@ void cpu_ppu_bus_write(uint8_t address, uint8_t value) {
 			} else {
 				PPU_state.T.coarse_x_scroll = (value >> 3) & 0b11111;
 				PPU_state.fine_x_scroll = value & 0b111;
+				log_line_event(LINE_EVENT_FINE_X, 0, PPU_state.fine_x_scroll);
 			}
 			PPU_state.address_latch = !PPU_state.address_latch;
 			break;
@@ -186,9 +274,6 @@ static inline void bg_msb_fetch() {
 }
 
 static inline void inc_horiz() {
-	if (!PPU_state.mask.show_background)
-		return;
-
 	if (PPU_state.V.coarse_x_scroll == 31) {
 		PPU_state.V.coarse_x_scroll = 0;
 		PPU_state.V.horizontal_nametable = ~PPU_state.V.horizontal_nametable;
@@ -198,9 +283,6 @@ static inline void inc_horiz() {
 }
 
 static inline void inc_vert() {
-	if (!PPU_state.mask.show_background)
-		return;
-
 	if (PPU_state.V.fine_y_scroll < 7) {
 		PPU_state.V.fine_y_scroll++;
 	} else {
@@ -225,250 +307,369 @@ static inline void load_shifters() {
 }
 
 
-void tick_frame() {
-	if (!rom_loaded) return;
-	for (scanline = -1; scanline <= 260; scanline++) {
-		for (dot = 0; dot <= 340; dot++) {
-			if (cpu_timer == 0) {
-				step6502();
-				cpu_timer = clockticks6502 + clockticks6502 + clockticks6502;
-			} else {
-				cpu_timer--;
+// Sprites are drawn into a line buffer once the shifters are loaded at dot 340. The
+// shifters only move on dots where sprites are shown, so the buffer is indexed by how
+// many of those there have been. temp_oam and the shifters are caught up at the end
+// of the line so the state is the same as when they were clocked every dot.
+static uint8_t sprite_line[256];
+static uint16_t sprite_dots = 0;
+static uint8_t reversed_bits[256];
+
+static void draw_sprite_line() {
+	if (reversed_bits[1] == 0) {
+		for (size_t i = 0; i < 256; i++) {
+			uint8_t reversed = 0;
+			for (size_t bit = 0; bit < 8; bit++) {
+				if (i & (1 << bit)) reversed |= 0x80 >> bit;
 			}
+			reversed_bits[i] = reversed;
+		}
+	}
 
-			if (apu_timer == 2) {
-				apu_tick_triangle();
+	for (size_t i = 0; i < 256; i++) {
+		sprite_line[i] = 0;
+	}
+
+	for (size_t i = 0; i < num_sprites_on_row; i++) {
+		// Leftmost pixel in bit 0
+		bool flipped_x = (temp_oam[i].attributes & 0x40) != 0;
+		uint8_t lsb = flipped_x ? sprite_lsb[i] : reversed_bits[sprite_lsb[i]];
+		uint8_t msb = flipped_x ? sprite_msb[i] : reversed_bits[sprite_msb[i]];
+		uint8_t attributes = ((temp_oam[i].attributes & 0b11) << 2) | (temp_oam[i].attributes & SPRITE_BEHIND) | (i == 0 ? SPRITE_ZERO : 0);
+
+		for (size_t column = temp_oam[i].x; (lsb | msb) != 0 && column < 256; column++) {
+			uint8_t pixel = (lsb & 1) | ((msb & 1) << 1);
+			if (pixel != 0 && sprite_line[column] == 0) {
+				sprite_line[column] = attributes | pixel;
 			}
+			lsb >>= 1;
+			msb >>= 1;
+		}
+	}
+}
 
-			if (apu_timer == 5) {
-				apu_tick_triangle();
-				apu_tick(scanline + 1);
-				apu_timer = 0;
-			} else {
-				apu_timer++;
+static void advance_sprite_shifters(uint16_t dots) {
+	for (size_t i = 0; i < num_sprites_on_row; i++) {
+		if (temp_oam[i].x >= dots) {
+			temp_oam[i].x -= (uint8_t)dots;
+			continue;
+		}
+
+		uint16_t shifts = dots - temp_oam[i].x;
+		temp_oam[i].x = 0;
+		if (shifts >= 8) {
+			sprite_lsb[i] = 0;
+			sprite_msb[i] = 0;
+		} else if (temp_oam[i].attributes & 0x40) {
+			sprite_lsb[i] >>= shifts;
+			sprite_msb[i] >>= shifts;
+		} else {
+			sprite_lsb[i] <<= shifts;
+			sprite_msb[i] <<= shifts;
+		}
+	}
+}
+
+static void begin_line_log() {
+	logging_line = &line_logs[scanline];
+	logging_line->pattern_plane_0 = pattern_plane_0;
+	logging_line->pattern_plane_1 = pattern_plane_1;
+	logging_line->attrib_0 = attrib_0;
+	logging_line->attrib_1 = attrib_1;
+	logging_line->mask = PPU_state.mask.value;
+	logging_line->fine_x_scroll = PPU_state.fine_x_scroll;
+	memcpy(logging_line->palette, PPU_state.palette, sizeof(logging_line->palette));
+	memcpy(logging_line->sprite_line, sprite_line, sizeof(logging_line->sprite_line));
+	logging_line->event_count = 0;
+}
+
+// Sprite 0 hit is the only part of a pixel the CPU can see
+static inline void sprite_zero_check(const bool show_background) {
+	if ((sprite_line[sprite_dots] & SPRITE_ZERO) && !PPU_state.status.sprite_0_hit && temp_oam[0].y == PPU_state.OAM[0].y) {
+		uint16_t bg_bit = 0x8000 >> PPU_state.fine_x_scroll;
+
+		if (show_background && (PPU_state.mask.show_background_left || dot > 8) && ((pattern_plane_0 | pattern_plane_1) & bg_bit)) {
+			PPU_state.status.sprite_0_hit = 1;
+		}
+	}
+	sprite_dots++;
+}
+
+static void build_line_sprites(uint8_t height) {
+	for (size_t line = 0; line < 240; line++) {
+		line_sprite_count[line] = 0;
+	}
+
+	for (uint8_t i = 0; i < 64; i++) {
+		size_t top = PPU_state.OAM[i].y;
+		for (size_t line = top; line < top + height && line < 240; line++) {
+			if (line_sprite_count[line] < 8) {
+				line_sprites[line][line_sprite_count[line]++] = i;
 			}
+		}
+	}
 
-			if (scanline <= 239) {
-				if (scanline == -1 && dot == 1) {
-					PPU_state.status.vertical_blank_started = 0;
-					PPU_state.status.sprite_overflow = 0;
-					PPU_state.status.sprite_0_hit = 0;
-				}
+	line_sprites_dirty = false;
+	line_sprites_height = height;
+}
 
-				if ((dot >= 2 && dot < 258) || (dot >= 321 && dot < 338)) {
-					if (PPU_state.mask.show_background) {
-						pattern_plane_0 <<= 1;
-						pattern_plane_1 <<= 1;
-						attrib_0 <<= 1;
-						attrib_1 <<= 1;
-					}
+static void evaluate_sprites() {
+	for (size_t i = 0; i < 8; i++) {
+		temp_oam[i].x = 0xFF;
+		temp_oam[i].y = 0xFF;
+		temp_oam[i].attributes = 0xFF;
+		temp_oam[i].tile_index = 0xFF;
+	}
 
-					switch ((dot - 1) % 8) {
-						case 0:
-							load_shifters();
-							nametable_fetch();
-							break;
-						case 2:
-							attribute_fetch();
-							break;
-						case 4:
-							bg_lsb_fetch();
-							break;
-						case 6:
-							bg_msb_fetch();
-							break;
-						case 7:
-							inc_horiz();
-							break;
-					}
-				}
+	num_sprites_on_row = 0;
+	if (scanline < 0) return;
+
+	uint8_t height = PPU_state.control.sprite_size == 0 ? 8 : 16;
+	if (line_sprites_dirty || line_sprites_height != height) {
+		build_line_sprites(height);
+	}
+
+	num_sprites_on_row = line_sprite_count[scanline];
+	for (size_t i = 0; i < num_sprites_on_row; i++) {
+		temp_oam[i] = PPU_state.OAM[line_sprites[scanline][i]];
+	}
+	if (num_sprites_on_row == 8) {
+		PPU_state.status.sprite_overflow = 1;
+	}
+}
 
+static bool logging_video = false;
+
+static ALWAYS_INLINE void cpu_apu_dot() {
+	if (cpu_timer == 0) {
+		idle_step();
+		if (oam_dma_pending) {
+			// 513 cycles, plus one to line up with a get cycle if the transfer starts on a put cycle
+			bool put_cycle = (apu_timer + cpu_timer) % 6 >= 3;
+			cpu_timer += 3 * (513 + (put_cycle ? 1 : 0));
+			if (trace_enabled) trace_cycles += 513 + (put_cycle ? 1 : 0);
+			oam_dma_pending = false;
+		}
+	} else {
+		cpu_timer--;
+	}
 
-				if (dot == 256) {
-					inc_vert();
-				} else if (dot == 257) {
-					load_shifters();
+	if (apu_timer == 2) {
+		apu_tick_triangle();
+	}
 
-					if (PPU_state.mask.show_background || PPU_state.mask.show_sprites) {
-						PPU_state.V.horizontal_nametable = PPU_state.T.horizontal_nametable;
-						PPU_state.V.coarse_x_scroll = PPU_state.T.coarse_x_scroll;
-					}
+	if (apu_timer == 5) {
+		apu_tick_triangle();
+		apu_tick();
+		apu_timer = 0;
+	} else {
+		apu_timer++;
+	}
+}
 
-					if (PPU_state.mask.show_sprites) {
-						for (size_t i = 0; i < 8; i++) {
-							temp_oam[i].x = 0xFF;
-							temp_oam[i].y = 0xFF;
-							temp_oam[i].attributes = 0xFF;
-							temp_oam[i].tile_index = 0xFF;
-						}
-
-						num_sprites_on_row = 0;
-
-						if (PPU_state.mask.show_sprites) {
-							for (size_t i = 0; i < 64; i++) {
-								int delta_y = scanline - (int)PPU_state.OAM[i].y;
-								if (delta_y >= 0 && (PPU_state.control.sprite_size == 0 ? delta_y < 8 : delta_y < 16)) {
-									if (num_sprites_on_row < 8) {
-										temp_oam[num_sprites_on_row].y = PPU_state.OAM[i].y;
-										temp_oam[num_sprites_on_row].tile_index = PPU_state.OAM[i].tile_index;
-										temp_oam[num_sprites_on_row].attributes = PPU_state.OAM[i].attributes;
-										temp_oam[num_sprites_on_row].x = PPU_state.OAM[i].x;
-										num_sprites_on_row++;
-										if (num_sprites_on_row == 8) {
-											PPU_state.status.sprite_overflow = 1;
-										}
-									}
-								}
-							}
-						}
-					}
-				} else if (dot == 338) {
-					nametable_fetch();
-				} else if (dot == 340) {
-					if (cartridge_scanline != NULL && (PPU_state.mask.show_background || PPU_state.mask.show_sprites)) {
-						cartridge_scanline();
-					}
-					nametable_fetch();
-					if (PPU_state.mask.show_sprites) {
-						for (size_t i = 0; i < num_sprites_on_row; i++) {
-							if (PPU_state.control.sprite_size) {
-								// Tall sprites
-
-								bool flipped_y = (temp_oam[i].attributes & 0x80) != 0;
-								int y_offset = scanline - (int)temp_oam[i].y;
-
-								if (flipped_y) {
-									y_offset = 15 - y_offset;
-								}
-
-								uint8_t sprite_index = temp_oam[i].tile_index & 0xFE;
-								if (y_offset > 7) {
-									y_offset -= 8;
-									sprite_index++;
-								}
-
-								nametable_address.fine_y_offset = (uint8_t)y_offset;
-
-								nametable_address.bit_plane = 0;
-								nametable_address.tile_lo = sprite_index;
-								nametable_address.tile_hi = (sprite_index >> 4) & 0xF;
-								nametable_address.pattern_table_half = temp_oam[i].tile_index & 1;
-							} else {
-								// Normal sprites
-								nametable_address.fine_y_offset = (uint8_t)(scanline - (int)temp_oam[i].y);
-								bool flipped_y = (temp_oam[i].attributes & 0x80) != 0;
-								if (flipped_y) {
-									nametable_address.fine_y_offset = (uint8_t)(7 - nametable_address.fine_y_offset);
-								}
-
-								nametable_address.bit_plane = 0;
-								nametable_address.tile_lo = temp_oam[i].tile_index & 0xF;
-								nametable_address.tile_hi = (temp_oam[i].tile_index >> 4) & 0xF;
-								nametable_address.pattern_table_half = PPU_state.control.sprite_pattern_table_address;
-							}
-
-							sprite_lsb[i] = cartridge_ppuRead(nametable_address.value);
-							nametable_address.bit_plane = 1;
-							sprite_msb[i] = cartridge_ppuRead(nametable_address.value);
-						}
-					}
-				}
+// One dot of the pre-render line or a visible line. Each line variant below has its own
+// copy with the mode as constants, so the branches the mode decides are compiled out.
+static ALWAYS_INLINE void render_dot(const bool visible, const bool show_background, const bool show_sprites) {
+	if (!visible && dot == 1) {
+		PPU_state.status.vertical_blank_started = 0;
+		PPU_state.status.sprite_overflow = 0;
+		PPU_state.status.sprite_0_hit = 0;
+	}
+
+	if (visible && dot == 1 && logging_video) {
+		begin_line_log();
+	}
 
-				if (PPU_state.mask.show_background && scanline == -1 && dot >= 280 && dot <= 304) {
-					PPU_state.V.coarse_y_scroll = PPU_state.T.coarse_y_scroll;
-					PPU_state.V.fine_y_scroll = PPU_state.T.fine_y_scroll;
-					PPU_state.V.vertical_nametable = PPU_state.T.vertical_nametable;
+	if ((dot >= 2 && dot < 258) || (dot >= 321 && dot < 338)) {
+		if (show_background) {
+			pattern_plane_0 <<= 1;
+			pattern_plane_1 <<= 1;
+			attrib_0 <<= 1;
+			attrib_1 <<= 1;
+		}
+
+		switch ((dot - 1) % 8) {
+			case 0:
+				if (logging_line && dot >= 9) {
+					uint8_t* load = logging_line->loads[(dot - 9) >> 3];
+					load[0] = next_pattern_lsb;
+					load[1] = next_pattern_msb;
+					load[2] = next_attribute;
 				}
+				load_shifters();
+				nametable_fetch();
+				break;
+			case 2:
+				attribute_fetch();
+				break;
+			case 4:
+				bg_lsb_fetch();
+				break;
+			case 6:
+				bg_msb_fetch();
+				break;
+			case 7:
+				if (show_background) inc_horiz();
+				break;
+		}
+	}
 
-				if (scanline >= 0 && dot >= 1 && dot <= 256) {
-					uint8_t bg_pixel = 0;
-					uint8_t bg_palette = 0;
 
-					bool show_background = PPU_state.mask.show_background && (PPU_state.mask.show_background_left || dot > 8);
+	if (dot == 256) {
+		if (show_background) inc_vert();
+	} else if (dot == 257) {
+		load_shifters();
 
-					if (show_background) {
-						uint16_t bit = 0x8000 >> PPU_state.fine_x_scroll;
+		if (show_background || show_sprites) {
+			PPU_state.V.horizontal_nametable = PPU_state.T.horizontal_nametable;
+			PPU_state.V.coarse_x_scroll = PPU_state.T.coarse_x_scroll;
+		}
+
+		if (show_sprites) {
+			evaluate_sprites();
+		}
+	} else if (dot == 338) {
+		nametable_fetch();
+	} else if (dot == 340) {
+		if (cartridge_scanline != NULL && (show_background || show_sprites)) {
+			cartridge_scanline();
+		}
+		nametable_fetch();
+		if (show_sprites) {
+			for (size_t i = 0; i < num_sprites_on_row; i++) {
+				if (PPU_state.control.sprite_size) {
+					// Tall sprites
 
-						uint8_t lo_bit = (pattern_plane_0 & bit) ? 1 : 0;
-						uint8_t hi_bit = (pattern_plane_1 & bit) ? 1 : 0;
-						bg_pixel = (hi_bit << 1) | lo_bit;
+					bool flipped_y = (temp_oam[i].attributes & 0x80) != 0;
+					int y_offset = scanline - (int)temp_oam[i].y;
 
-						uint8_t attr_lo = (attrib_0 & bit) ? 1 : 0;
-						uint8_t attr_hi = (attrib_1 & bit) ? 1 : 0;
-						bg_palette = (attr_hi << 3) | (attr_lo << 2);
+					if (flipped_y) {
+						y_offset = 15 - y_offset;
 					}
 
-					int first_found = -1;
-					uint8_t sprite_pixel = 0;
-					uint8_t sprite_palette = 0;
-
-					if (PPU_state.mask.show_sprites) {
-						for (int sprite_n = 0; sprite_n < num_sprites_on_row; sprite_n++) {
-							if (temp_oam[sprite_n].x == 0) {
-								bool flipped_x = (temp_oam[sprite_n].attributes & 0x40) != 0;
-								if (sprite_pixel == 0) {
-									uint8_t lo_bit = (sprite_lsb[sprite_n] & (flipped_x ? 1 : 0x80)) ? 1 : 0;
-									uint8_t hi_bit = (sprite_msb[sprite_n] & (flipped_x ? 1 : 0x80)) ? 1 : 0;
-									uint8_t pix = (hi_bit << 1) | lo_bit;
-
-									if (pix != 0) {
-										first_found = sprite_n;
-										if (sprite_n == 0 && bg_pixel != 0 && temp_oam[0].y == PPU_state.OAM[0].y) {
-											PPU_state.status.sprite_0_hit = 1;
-										}
-
-										sprite_pixel = pix;
-										sprite_palette = (temp_oam[sprite_n].attributes & 0b11) << 2;
-									}
-								}
-
-								if (flipped_x) {
-									sprite_lsb[sprite_n] >>= 1;
-									sprite_msb[sprite_n] >>= 1;
-								} else {
-									sprite_lsb[sprite_n] <<= 1;
-									sprite_msb[sprite_n] <<= 1;
-								}
-							} else {
-								temp_oam[sprite_n].x--;
-							}
-						}
+					uint8_t sprite_index = temp_oam[i].tile_index & 0xFE;
+					if (y_offset > 7) {
+						y_offset -= 8;
+						sprite_index++;
 					}
 
-					uint16_t output_palette_location = 0x00;
-					uint8_t output_pixel = bg_pixel;
-					uint8_t output_palette = bg_palette;
-
-					bool show_sprites = PPU_state.mask.show_sprites && (PPU_state.mask.show_background_left || dot > 8);
-
-					if (show_sprites) {
-						if (bg_pixel == 0 && sprite_pixel != 0) {
-							output_pixel = sprite_pixel;
-							output_palette = sprite_palette;
-							output_palette_location = 0x10;
-						} else if (sprite_pixel != 0 && bg_pixel != 0) {
-							if (((temp_oam[first_found].attributes >> 5) & 1) == 0) {
-								output_pixel = sprite_pixel;
-								output_palette = sprite_palette;
-								output_palette_location = 0x10;
-							}
-						}
+					nametable_address.fine_y_offset = (uint8_t)y_offset;
+
+					nametable_address.bit_plane = 0;
+					nametable_address.tile_lo = sprite_index;
+					nametable_address.tile_hi = (sprite_index >> 4) & 0xF;
+					nametable_address.pattern_table_half = temp_oam[i].tile_index & 1;
+				} else {
+					// Normal sprites
+					nametable_address.fine_y_offset = (uint8_t)(scanline - (int)temp_oam[i].y);
+					bool flipped_y = (temp_oam[i].attributes & 0x80) != 0;
+					if (flipped_y) {
+						nametable_address.fine_y_offset = (uint8_t)(7 - nametable_address.fine_y_offset);
 					}
 
-					//uint8_t palette_index = ppu_internal_bus_read((uint16_t)(output_palette_location | output_palette | output_pixel)) & 0x3f;
-					uint16_t palette_addr = output_palette_location | output_palette | output_pixel;
-					uint8_t palette_index = PPU_state.palette[(palette_addr & 0x3) == 0 ? 0 : (palette_addr & 0x1F)] & 0x3f;
-					pixformat_t* pixel = &framebuffer[(size_t)256 * scanline + (dot - 1)];
-					pixel->r = palette_colors[palette_index * 3 + 0];
-					pixel->g = palette_colors[palette_index * 3 + 1];
-					pixel->b = palette_colors[palette_index * 3 + 2];
-				}
-			} else if (scanline == 241 && dot == 1) {
-				PPU_state.status.vertical_blank_started = 1;
-				if (PPU_state.control.gen_nmi_vblank) {
-					nmi6502();
+					nametable_address.bit_plane = 0;
+					nametable_address.tile_lo = temp_oam[i].tile_index & 0xF;
+					nametable_address.tile_hi = (temp_oam[i].tile_index >> 4) & 0xF;
+					nametable_address.pattern_table_half = PPU_state.control.sprite_pattern_table_address;
 				}
+
+				sprite_lsb[i] = cartridge_ppuRead(nametable_address.value);
+				nametable_address.bit_plane = 1;
+				sprite_msb[i] = cartridge_ppuRead(nametable_address.value);
+			}
+		}
+		draw_sprite_line();
+	}
+
+	if (show_background && !visible && dot >= 280 && dot <= 304) {
+		PPU_state.V.coarse_y_scroll = PPU_state.T.coarse_y_scroll;
+		PPU_state.V.fine_y_scroll = PPU_state.T.fine_y_scroll;
+		PPU_state.V.vertical_nametable = PPU_state.T.vertical_nametable;
+	}
+
+	if (show_sprites && visible && dot >= 1 && dot <= 256) {
+		// Pixels are drawn from the line log, only sprite 0 hit is needed here
+		sprite_zero_check(show_background);
+	}
+
+	if (visible && dot == 256) {
+		advance_sprite_shifters(sprite_dots);
+		sprite_dots = 0;
+		if (logging_line) {
+			logging_line = NULL;
+			video_line_logged(scanline);
+		}
+	}
+}
+
+// Runs the rest of the line from dot, returns early when the rendering mode changes.
+// The CPU has already run for the current dot when a variant is entered.
+#define LINE_VARIANT(name, visible, show_background, show_sprites) \
+	static void name() { \
+		for (;;) { \
+			render_dot(visible, show_background, show_sprites); \
+			if (++dot > 340) return; \
+			cpu_apu_dot(); \
+			if (rendering_mode_changed) return; \
+		} \
+	}
+
+LINE_VARIANT(prerender_line_off, false, false, false)
+LINE_VARIANT(prerender_line_sprites, false, false, true)
+LINE_VARIANT(prerender_line_background, false, true, false)
+LINE_VARIANT(prerender_line_both, false, true, true)
+LINE_VARIANT(visible_line_off, true, false, false)
+LINE_VARIANT(visible_line_sprites, true, false, true)
+LINE_VARIANT(visible_line_background, true, true, false)
+LINE_VARIANT(visible_line_both, true, true, true)
+
+typedef void(*line_variant_t)();
+static const line_variant_t line_variants[8] = {
+	prerender_line_off, prerender_line_sprites, prerender_line_background, prerender_line_both,
+	visible_line_off, visible_line_sprites, visible_line_background, visible_line_both
+};
+
+static void run_rendering_line() {
+	dot = 0;
+	cpu_apu_dot();
+	while (dot <= 340) {
+		rendering_mode_changed = false;
+		size_t mode = (scanline >= 0 ? 4 : 0) | (PPU_state.mask.show_background ? 2 : 0) | (PPU_state.mask.show_sprites ? 1 : 0);
+		line_variants[mode]();
+	}
+}
+
+// Lines 240 to 260, where the PPU only raises vblank
+static void run_idle_line() {
+	for (dot = 0; dot <= 340; dot++) {
+		cpu_apu_dot();
+		if (scanline == 241 && dot == 1) {
+			PPU_state.status.vertical_blank_started = 1;
+			if (PPU_state.control.gen_nmi_vblank) {
+				nmi6502();
 			}
 		}
 	}
 }
+
+void tick_frame() {
+	if (!rom_loaded) return;
+	logging_video = video_output_enabled;
+	memset(framebuffer_dirty, 0, sizeof(framebuffer_dirty));
+	if (logging_video) {
+		video_begin_frame();
+	}
+	for (scanline = -1; scanline <= 260; scanline++) {
+		if (scanline <= 239) {
+			run_rendering_line();
+		} else {
+			run_idle_line();
+		}
+	}
+
+	if (logging_video) {
+		video_end_frame();
+		framebuffer_phase = (framebuffer_phase + 1) % 3;
+	}
+	apu_end_frame();
+}
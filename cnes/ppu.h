@@ -2,6 +2,9 @@
 #define _PPU_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "stream.h"
 
 typedef union {
 	struct {
@@ -71,8 +74,14 @@ typedef struct {
 
 extern ppu_state_t PPU_state;
 extern size_t cpu_timer;
+// Set by a $4014 write, the CPU is halted for the transfer once the instruction is done
+extern bool oam_dma_pending;
 extern int scanline;
 extern int dot;
 void ppu_reset();
+// Copies a whole page into OAM starting at oam_address, like 256 writes to $2004
+void ppu_oam_dma(const uint8_t* page);
+void ppu_save_state(void* stream, stream_writer write);
+void ppu_load_state(void* stream, stream_reader read);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include <string.h>
+#include "statehash.h"
+#include "include/cnes.h"
+
+#define PAGE_SIZE 256
+#define MAX_PAGES 128
+
+uint64_t state_dirty_pages[STATE_REGION_COUNT][2];
+
+static struct {
+	const uint8_t* memory;
+	size_t size;
+	uint64_t page_hashes[MAX_PAGES];
+} regions[STATE_REGION_COUNT];
+
+static uint64_t hash;
+
+static inline uint64_t mix(uint64_t h, uint64_t word) {
+	h ^= word * 0x9E3779B97F4A7C15ULL;
+	h = (h << 31) | (h >> 33);
+	return h * 0xBF58476D1CE4E5B9ULL;
+}
+
+static uint64_t hash_bytes(uint64_t h, const uint8_t* data, size_t size) {
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = mix(h, word);
+	}
+	uint64_t tail = 0;
+	for (; i < size; i++) {
+		tail = (tail << 8) | data[i];
+	}
+	return mix(h, tail ^ ((uint64_t)size << 56));
+}
+
+void state_hash_region(state_region_t region, const uint8_t* memory, size_t size) {
+	regions[region].memory = memory;
+	regions[region].size = memory && size <= PAGE_SIZE * MAX_PAGES ? size : 0;
+	state_dirty_pages[region][0] = state_dirty_pages[region][1] = ~(uint64_t)0;
+}
+
+void state_hash_invalidate() {
+	memset(state_dirty_pages, 0xFF, sizeof(state_dirty_pages));
+}
+
+static void hash_region(state_region_t region) {
+	size_t pages = (regions[region].size + PAGE_SIZE - 1) / PAGE_SIZE;
+	for (size_t page = 0; page < pages; page++) {
+		uint64_t bit = (uint64_t)1 << (page & 63);
+		uint64_t* dirty = &state_dirty_pages[region][page >> 6];
+		if (*dirty & bit) {
+			size_t offset = page * PAGE_SIZE;
+			size_t size = regions[region].size - offset < PAGE_SIZE ? regions[region].size - offset : PAGE_SIZE;
+			regions[region].page_hashes[page] = hash_bytes(page, regions[region].memory + offset, size);
+		}
+		hash = mix(hash, regions[region].page_hashes[page]);
+	}
+	state_dirty_pages[region][0] = state_dirty_pages[region][1] = 0;
+}
+
+static void hash_write(const void* data, size_t element_size, size_t element_count, void* stream) {
+	size_t size = element_size * element_count;
+	for (size_t region = 0; region < STATE_REGION_COUNT; region++) {
+		if (data == regions[region].memory && size == regions[region].size) {
+			hash_region((state_region_t)region);
+			return;
+		}
+	}
+	hash = hash_bytes(hash, (const uint8_t*)data, size);
+}
+
+uint64_t cnes_state_hash() {
+	hash = 0x6A09E667F3BCC908ULL;
+	save_state(NULL, hash_write);
+	// Spread the last words over every bit
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	return hash;
+}
@@ -0,0 +1,42 @@
+#ifndef _STATEHASH_H_
+#define _STATEHASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Memory that save_state writes in one piece is hashed in 256 byte pages, and a page
+// is only hashed again after a write has marked it dirty.
+
+typedef enum {
+	STATE_CPURAM,
+	STATE_CIRAM,
+	STATE_CHR_RAM,
+	STATE_PRG_RAM,
+	STATE_REGION_COUNT
+} state_region_t;
+
+// One bit per page, up to 32 KB per region
+extern uint64_t state_dirty_pages[STATE_REGION_COUNT][2];
+
+static inline void state_mark_dirty(state_region_t region, size_t offset) {
+	size_t page = (offset >> 8) & 127;
+	state_dirty_pages[region][page >> 6] |= (uint64_t)1 << (page & 63);
+}
+
+// A write through the PPU bus. It can't know how the mapper mirrors nametables,
+// so it marks every page of CIRAM the address could end up in
+static inline void state_mark_ppu_write(uint16_t address) {
+	address &= 0x3FFF;
+	if (address < 0x2000) {
+		state_mark_dirty(STATE_CHR_RAM, address);
+	} else {
+		state_dirty_pages[STATE_CIRAM][0] |= (uint64_t)0x11 << ((address >> 8) & 3);
+	}
+}
+
+// The memory save_state writes for a region, NULL when there is none
+void state_hash_region(state_region_t region, const uint8_t* memory, size_t size);
+// Every page is hashed again next time, for when memory changed without being marked
+void state_hash_invalidate();
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../fake6502.h"
+#include "eager6502.h"
+
+// Runs every opcode from every A and memory value and a set of starting flags on both the
+// core and the eager reference, followed by an NMI that pushes the status, and compares
+// the registers, the status with Z and N worked out, the cycles and every memory write.
+// X and Y are derived from A, the operand bytes point into zero page and page 2.
+
+#define MAX_WRITES 16
+
+// The opcode goes first
+static uint8_t program[3] = { 0, 0x10, 0x02 };
+static const uint8_t start_flags[] = { 0x20, 0x21, 0x22, 0x80, 0xC3, 0xE3, 0x62, 0xA1 };
+
+static uint8_t memory[65536];
+static uint8_t fill;
+uint8_t* prg_map[4] = { memory + 0x8000, memory + 0xA000, memory + 0xC000, memory + 0xE000 };
+
+typedef struct {
+	eager6502_t cpu;
+	eager6502_t after_nmi;
+	size_t write_count;
+	uint16_t write_address[MAX_WRITES];
+	uint8_t write_value[MAX_WRITES];
+} outcome_t;
+
+static outcome_t* recording;
+
+uint8_t read6502(uint16_t address) {
+	return memory[address];
+}
+
+void write6502(uint16_t address, uint8_t value) {
+	if (recording->write_count < MAX_WRITES) {
+		recording->write_address[recording->write_count] = address;
+		recording->write_value[recording->write_count] = value;
+	}
+	recording->write_count++;
+	memory[address] = value;
+}
+
+void idle_sync() {
+}
+
+// Puts back what the instruction wrote, for the next run to start from the same memory
+static void undo_writes(const outcome_t* outcome) {
+	size_t count = outcome->write_count < MAX_WRITES ? outcome->write_count : MAX_WRITES;
+	for (size_t i = 0; i < count; i++) {
+		memory[outcome->write_address[i]] = fill;
+	}
+	memcpy(&memory[0x8000], program, sizeof(program));
+}
+
+static void read_core(eager6502_t* cpu) {
+	cpu->pc = pc;
+	cpu->sp = sp;
+	cpu->a = a;
+	cpu->x = x;
+	cpu->y = y;
+	cpu->status = status6502();
+	cpu->clockticks = clockticks6502;
+}
+
+static void run_core(const eager6502_t* start, outcome_t* outcome) {
+	memset(outcome, 0, sizeof(*outcome));
+	recording = outcome;
+	pc = start->pc;
+	sp = start->sp;
+	a = start->a;
+	x = start->x;
+	y = start->y;
+	set_status6502(start->status);
+	step6502();
+	read_core(&outcome->cpu);
+	nmi6502();
+	read_core(&outcome->after_nmi);
+	undo_writes(outcome);
+}
+
+static void run_eager(const eager6502_t* start, outcome_t* outcome) {
+	memset(outcome, 0, sizeof(*outcome));
+	recording = outcome;
+	eager6502_set(start);
+	eager6502_step();
+	eager6502_get(&outcome->cpu);
+	eager6502_nmi();
+	eager6502_get(&outcome->after_nmi);
+	undo_writes(outcome);
+}
+
+static bool same_registers(const eager6502_t* left, const eager6502_t* right) {
+	return left->pc == right->pc && left->sp == right->sp && left->a == right->a && left->x == right->x &&
+		left->y == right->y && left->status == right->status && left->clockticks == right->clockticks;
+}
+
+static bool same_outcome(const outcome_t* left, const outcome_t* right) {
+	if (!same_registers(&left->cpu, &right->cpu) || !same_registers(&left->after_nmi, &right->after_nmi)) return false;
+	if (left->write_count != right->write_count) return false;
+	size_t count = left->write_count < MAX_WRITES ? left->write_count : MAX_WRITES;
+	return memcmp(left->write_address, right->write_address, count * sizeof(uint16_t)) == 0 &&
+		memcmp(left->write_value, right->write_value, count) == 0;
+}
+
+int main() {
+	size_t cases = 0;
+	size_t failures = 0;
+	for (int op = 0; op < 256; op++) {
+		for (int m = 0; m < 256; m++) {
+			fill = (uint8_t)m;
+			memset(memory, m, sizeof(memory));
+			program[0] = (uint8_t)op;
+			memcpy(&memory[0x8000], program, sizeof(program));
+			for (int value = 0; value < 256; value++) {
+				for (size_t f = 0; f < sizeof(start_flags); f++) {
+					eager6502_t start = { 0x8000, (uint8_t)(0xF0 + (m & 7)), (uint8_t)value, (uint8_t)(value ^ 0x3C), (uint8_t)~value, start_flags[f], 0 };
+					outcome_t expected, actual;
+					run_eager(&start, &expected);
+					run_core(&start, &actual);
+					cases++;
+					if (same_outcome(&expected, &actual)) continue;
+					if (failures++ < 10) {
+						printf("opcode %02X, memory %02X, A %02X, flags %02X: status %02X/%02X after the step, %02X/%02X after NMI, %zu/%zu writes\n",
+							op, m, value, start_flags[f], expected.cpu.status, actual.cpu.status,
+							expected.after_nmi.status, actual.after_nmi.status, expected.write_count, actual.write_count);
+					}
+				}
+			}
+		}
+	}
+	printf("%zu cases, %zu differ from the eager reference\n", cases, failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#ifndef _EAGER6502_H_
+#define _EAGER6502_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The registers of the reference core in fake6502_eager.c
+typedef struct {
+	uint16_t pc;
+	uint8_t sp, a, x, y, status;
+	size_t clockticks;
+} eager6502_t;
+
+// clockticks is left out, step sets it
+void eager6502_set(const eager6502_t* cpu);
+void eager6502_get(eager6502_t* cpu);
+void eager6502_step();
+void eager6502_nmi();
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "include/cnes.h"
+#include "trace.h"
+#include "fake6502.h"
+#include "nes001.h"
+#include "ppu.h"
+#include "idle.h"
+
+// A stream trace goes out in blocks: the record count and the length of the rest, 32
+// bits each, then the records. Each record is packed into PACKED_SIZE bytes with the
+// cycle counted from the record before, and only the bytes that differ from the record
+// before are stored, after a mask of which ones those are. From one instruction to the
+// next most of them don't, so a record takes around 10 bytes.
+
+#define PACKED_SIZE 22
+#define MASK_SIZE ((PACKED_SIZE + 7) / 8)
+
+bool trace_enabled = false;
+uint64_t trace_cycles = 0;
+
+static cnes_trace_record_t* ring = NULL;
+static size_t capacity = 0;
+static size_t position = 0;
+static size_t recorded = 0;
+
+static void* stream = NULL;
+static stream_writer stream_write = NULL;
+static cnes_trace_record_t block[CNES_TRACE_BLOCK_RECORDS];
+static uint8_t packed_block[8 + CNES_TRACE_BLOCK_RECORDS * (MASK_SIZE + PACKED_SIZE)];
+
+static void put16(uint8_t* out, uint16_t value) {
+	out[0] = (uint8_t)value;
+	out[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t get16(const uint8_t* in) {
+	return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static void put32(uint8_t* out, uint32_t value) {
+	put16(out, (uint16_t)value);
+	put16(out + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t get32(const uint8_t* in) {
+	return get16(in) | ((uint32_t)get16(in + 2) << 16);
+}
+
+static void pack(const cnes_trace_record_t* record, uint64_t previous_cycle, uint8_t* out) {
+	uint64_t cycles = record->cycle - previous_cycle;
+	put32(out, (uint32_t)cycles);
+	put32(out + 4, (uint32_t)(cycles >> 32));
+	put16(out + 8, record->pc);
+	memcpy(out + 10, record->bytes, 3);
+	out[13] = record->a;
+	out[14] = record->x;
+	out[15] = record->y;
+	out[16] = record->sp;
+	out[17] = record->p;
+	put16(out + 18, (uint16_t)record->scanline);
+	put16(out + 20, record->dot);
+}
+
+static void unpack(const uint8_t* in, uint64_t previous_cycle, cnes_trace_record_t* record) {
+	record->cycle = previous_cycle + (get32(in) | ((uint64_t)get32(in + 4) << 32));
+	record->pc = get16(in + 8);
+	memcpy(record->bytes, in + 10, 3);
+	record->a = in[13];
+	record->x = in[14];
+	record->y = in[15];
+	record->sp = in[16];
+	record->p = in[17];
+	record->scanline = (int16_t)get16(in + 18);
+	record->dot = get16(in + 20);
+}
+
+static void flush() {
+	if (position == 0) return;
+
+	uint8_t previous[PACKED_SIZE] = { 0 };
+	uint64_t previous_cycle = 0;
+	uint8_t* out = packed_block + 8;
+	for (size_t i = 0; i < position; i++) {
+		uint8_t current[PACKED_SIZE];
+		pack(&block[i], previous_cycle, current);
+		previous_cycle = block[i].cycle;
+
+		uint8_t* mask = out;
+		memset(mask, 0, MASK_SIZE);
+		out += MASK_SIZE;
+		for (size_t j = 0; j < PACKED_SIZE; j++) {
+			if (current[j] != previous[j]) {
+				mask[j >> 3] |= 1 << (j & 7);
+				*out++ = current[j];
+			}
+		}
+		memcpy(previous, current, PACKED_SIZE);
+	}
+
+	size_t length = (size_t)(out - packed_block);
+	put32(packed_block, (uint32_t)position);
+	put32(packed_block + 4, (uint32_t)(length - 8));
+	stream_write(packed_block, 1, length, stream);
+	position = 0;
+}
+
+void trace_step() {
+	cnes_trace_record_t* record = &ring[position];
+	record->cycle = trace_cycles;
+	record->pc = pc;
+	record->bytes[0] = peek6502(pc);
+	record->bytes[1] = peek6502(pc + 1);
+	record->bytes[2] = peek6502(pc + 2);
+	record->a = a;
+	record->x = x;
+	record->y = y;
+	record->sp = sp;
+	record->p = status6502();
+	record->scanline = (int16_t)scanline;
+	record->dot = (uint16_t)dot;
+
+	step6502();
+	trace_cycles += clockticks6502;
+	recorded++;
+
+	if (++position == capacity) {
+		if (stream_write) {
+			flush();
+		} else {
+			position = 0;
+		}
+	}
+}
+
+static void start(cnes_trace_record_t* records, size_t size) {
+	cnes_trace_stop();
+	// Leave any polling loop that is being skipped, idle_step won't look for new ones
+	idle_sync();
+	ring = records;
+	capacity = size;
+	position = 0;
+	recorded = 0;
+	trace_cycles = 0;
+	trace_enabled = capacity > 0;
+}
+
+void cnes_trace_to_ring(cnes_trace_record_t* records, size_t size) {
+	start(records, size);
+}
+
+void cnes_trace_to_stream(void* destination, stream_writer write) {
+	start(block, CNES_TRACE_BLOCK_RECORDS);
+	stream = destination;
+	stream_write = write;
+}
+
+void cnes_trace_stop() {
+	if (stream_write) flush();
+	trace_enabled = false;
+	stream = NULL;
+	stream_write = NULL;
+}
+
+size_t cnes_trace_count() {
+	return recorded;
+}
+
+size_t cnes_trace_unpack(const uint8_t* data, size_t size, cnes_trace_record_t* records, size_t* count) {
+	if (size < 8) return 0;
+	size_t record_count = get32(data);
+	size_t length = get32(data + 4);
+	if (record_count > CNES_TRACE_BLOCK_RECORDS || size - 8 < length) return 0;
+
+	const uint8_t* in = data + 8;
+	const uint8_t* end = in + length;
+	uint8_t current[PACKED_SIZE] = { 0 };
+	uint64_t previous_cycle = 0;
+	for (size_t i = 0; i < record_count; i++) {
+		if (end - in < MASK_SIZE) return 0;
+		const uint8_t* mask = in;
+		in += MASK_SIZE;
+		for (size_t j = 0; j < PACKED_SIZE; j++) {
+			if (mask[j >> 3] & (1 << (j & 7))) {
+				if (in == end) return 0;
+				current[j] = *in++;
+			}
+		}
+		unpack(current, previous_cycle, &records[i]);
+		previous_cycle = records[i].cycle;
+	}
+
+	*count = record_count;
+	return 8 + length;
+}
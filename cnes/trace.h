@@ -0,0 +1,15 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Set while a trace is recording, then idle_step runs instructions through trace_step
+extern bool trace_enabled;
+// CPU cycles since the trace started, for the next record
+extern uint64_t trace_cycles;
+
+// Records the instruction at pc and runs it
+void trace_step();
+
+#endif
@@ -0,0 +1,393 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "video.h"
+#include "include/cnes.h"
+
+#ifdef CNES_VIDEO_THREAD
+#include <threads.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+// Pixels are drawn from the line logs the PPU records, either right after each line or
+// on other threads while the CPU and PPU go on with the next lines. Both use the same
+// code, so the output is identical.
+
+#define MASK_SHOW_BACKGROUND_LEFT 0x02
+#define MASK_SHOW_BACKGROUND      0x08
+#define MASK_SHOW_SPRITES         0x10
+
+static const uint8_t palette_colors[192] =
+{
+	0x52, 0x52, 0x52, 0x01, 0x1A, 0x51, 0x0F, 0x0F, 0x65, 0x23, 0x06, 0x63, 0x36, 0x03, 0x4B, 0x40,
+	0x04, 0x26, 0x3F, 0x09, 0x04, 0x32, 0x13, 0x00, 0x1F, 0x20, 0x00, 0x0B, 0x2A, 0x00, 0x00, 0x2F,
+	0x00, 0x00, 0x2E, 0x0A, 0x00, 0x26, 0x2D, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xA0, 0xA0, 0xA0, 0x1E, 0x4A, 0x9D, 0x38, 0x37, 0xBC, 0x58, 0x28, 0xB8, 0x75, 0x21, 0x94, 0x84,
+	0x23, 0x5C, 0x82, 0x2E, 0x24, 0x6F, 0x3F, 0x00, 0x51, 0x52, 0x00, 0x31, 0x63, 0x00, 0x1A, 0x6B,
+	0x05, 0x0E, 0x69, 0x2E, 0x10, 0x5C, 0x68, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xFE, 0xFF, 0xFF, 0x69, 0x9E, 0xFC, 0x89, 0x87, 0xFF, 0xAE, 0x76, 0xFF, 0xCE, 0x6D, 0xF1, 0xE0,
+	0x70, 0xB2, 0xDE, 0x7C, 0x70, 0xC8, 0x91, 0x3E, 0xA6, 0xA7, 0x25, 0x81, 0xBA, 0x28, 0x63, 0xC4,
+	0x46, 0x54, 0xC1, 0x7D, 0x56, 0xB3, 0xC0, 0x3C, 0x3C, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xFE, 0xFF, 0xFF, 0xBE, 0xD6, 0xFD, 0xCC, 0xCC, 0xFF, 0xDD, 0xC4, 0xFF, 0xEA, 0xC0, 0xF9, 0xF2,
+	0xC1, 0xDF, 0xF1, 0xC7, 0xC2, 0xE8, 0xD0, 0xAA, 0xD9, 0xDA, 0x9D, 0xC9, 0xE2, 0x9E, 0xBC, 0xE6,
+	0xAE, 0xB4, 0xE5, 0xC7, 0xB5, 0xDF, 0xE4, 0xA9, 0xA9, 0xA9, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+line_log_t line_logs[240];
+static uint32_t line_dirty[240];
+
+unsigned int video_threads = 0;
+
+unsigned int gray_width = 0;
+unsigned int gray_height = 0;
+uint8_t framebuffer_gray[256 * 240];
+
+// The gray size this frame is drawn at, 0 for RGB
+static unsigned int frame_gray_width = 0;
+static unsigned int frame_gray_height = 0;
+static uint8_t palette_luma[64];
+
+// Source column x adds gray_columns_weight[x] of itself to gray_columns[x] and the rest of
+// frame_gray_width to the next one. Every gray column ends up with 256 in total, every gray
+// row with 240 from the lines
+static uint8_t gray_columns[256];
+static uint16_t gray_columns_weight[256];
+static uint8_t gray_rows[240];
+static uint16_t gray_rows_weight[240];
+
+// Each line box-filtered across to frame_gray_width, in 8.7 fixed point
+static uint16_t gray_lines[240][256];
+
+static void split_weights(unsigned int from, unsigned int to, uint8_t* index, uint16_t* weight) {
+	for (unsigned int i = 0; i < from; i++) {
+		// Source i covers [i * to, (i + 1) * to), destination j covers [j * from, (j + 1) * from)
+		unsigned int j = i * to / from;
+		unsigned int end = (j + 1) * from;
+		index[i] = (uint8_t)j;
+		weight[i] = (uint16_t)((i + 1) * to <= end ? to : end - i * to);
+	}
+}
+
+static void setup_gray(unsigned int width, unsigned int height) {
+	for (size_t i = 0; i < 64; i++) {
+		const uint8_t* color = &palette_colors[i * 3];
+		palette_luma[i] = (uint8_t)((299 * color[0] + 587 * color[1] + 114 * color[2] + 500) / 1000);
+	}
+	split_weights(256, width, gray_columns, gray_columns_weight);
+	split_weights(240, height, gray_rows, gray_rows_weight);
+	frame_gray_width = width;
+	frame_gray_height = height;
+}
+
+static void shrink_line(int line, const uint8_t* luma) {
+	uint32_t sums[257] = { 0 };
+	for (size_t x = 0; x < 256; x++) {
+		uint32_t weight = gray_columns_weight[x];
+		sums[gray_columns[x]] += luma[x] * weight;
+		sums[gray_columns[x] + 1] += luma[x] * (frame_gray_width - weight);
+	}
+	uint16_t* out = gray_lines[line];
+	for (size_t i = 0; i < frame_gray_width; i++) {
+		out[i] = (uint16_t)((sums[i] + 1) >> 1);
+	}
+}
+
+// sums += line * weight
+static void add_gray_line(uint32_t* sums, const uint16_t* line, uint16_t weight, size_t width) {
+	size_t i = 0;
+#ifdef USE_SSE2
+	__m128i w = _mm_set1_epi16((short)weight);
+	for (; i + 8 <= width; i += 8) {
+		__m128i values = _mm_loadu_si128((const __m128i*)&line[i]);
+		__m128i lo = _mm_mullo_epi16(values, w);
+		__m128i hi = _mm_mulhi_epu16(values, w);
+		__m128i* out = (__m128i*)&sums[i];
+		_mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), _mm_unpacklo_epi16(lo, hi)));
+		_mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(lo, hi)));
+	}
+#endif
+	for (; i < width; i++) {
+		sums[i] += (uint32_t)line[i] * weight;
+	}
+}
+
+static void finish_gray() {
+	static uint32_t sums[241 * 256];
+	size_t width = frame_gray_width;
+	memset(sums, 0, sizeof(uint32_t) * (frame_gray_height + 1) * width);
+	for (size_t line = 0; line < 240; line++) {
+		uint32_t* row = &sums[gray_rows[line] * width];
+		uint16_t weight = gray_rows_weight[line];
+		add_gray_line(row, gray_lines[line], weight, width);
+		if (weight < frame_gray_height) {
+			add_gray_line(row + width, gray_lines[line], (uint16_t)(frame_gray_height - weight), width);
+		}
+	}
+	// 128 from the fixed point times 240 from the rows
+	size_t count = width * frame_gray_height;
+	for (size_t i = 0; i < count; i++) {
+		framebuffer_gray[i] = (uint8_t)((sums[i] + 128 * 240 / 2) / (128 * 240));
+	}
+}
+
+static void draw_line(int line) {
+	const line_log_t* log = &line_logs[line];
+	uint16_t pattern_plane_0 = log->pattern_plane_0;
+	uint16_t pattern_plane_1 = log->pattern_plane_1;
+	uint16_t attrib_0 = log->attrib_0;
+	uint16_t attrib_1 = log->attrib_1;
+	uint8_t mask = log->mask;
+	uint8_t fine_x_scroll = log->fine_x_scroll;
+	uint8_t palette[32];
+	memcpy(palette, log->palette, sizeof(palette));
+
+	size_t event = 0;
+	int next_event_dot = log->event_count > 0 ? log->events[0].dot : 0;
+	size_t sprite_dots = 0;
+	uint32_t dirty = 0;
+	pixformat_t* pixels = &framebuffer[(size_t)256 * line];
+	uint16_t* indices = &framebuffer_indices[(size_t)256 * line];
+	bool gray = frame_gray_width != 0;
+	uint8_t luma[256];
+
+	for (int dot = 1; dot <= 256; dot++) {
+		while (dot == next_event_dot) {
+			const line_event_t* e = &log->events[event++];
+			switch (e->kind) {
+				case LINE_EVENT_MASK: mask = e->value; break;
+				case LINE_EVENT_FINE_X: fine_x_scroll = e->value; break;
+				case LINE_EVENT_PALETTE: palette[e->index] = e->value; break;
+			}
+			next_event_dot = event < log->event_count ? log->events[event].dot : 0;
+		}
+
+		// The same shifting and loading the PPU did at this dot
+		if (dot >= 2) {
+			if (mask & MASK_SHOW_BACKGROUND) {
+				pattern_plane_0 <<= 1;
+				pattern_plane_1 <<= 1;
+				attrib_0 <<= 1;
+				attrib_1 <<= 1;
+			}
+			if (((dot - 1) & 7) == 0) {
+				const uint8_t* load = log->loads[(dot - 9) >> 3];
+				pattern_plane_0 |= load[0];
+				pattern_plane_1 |= load[1];
+				attrib_0 |= ((load[2] & 1) ? 0xFF : 0);
+				attrib_1 |= ((load[2] & 2) ? 0xFF : 0);
+			}
+		}
+
+		uint8_t bg_pixel = 0;
+		uint8_t bg_palette = 0;
+
+		bool show_background = (mask & MASK_SHOW_BACKGROUND) && ((mask & MASK_SHOW_BACKGROUND_LEFT) || dot > 8);
+
+		if (show_background) {
+			uint16_t bit = 0x8000 >> fine_x_scroll;
+
+			uint8_t lo_bit = (pattern_plane_0 & bit) ? 1 : 0;
+			uint8_t hi_bit = (pattern_plane_1 & bit) ? 1 : 0;
+			bg_pixel = (hi_bit << 1) | lo_bit;
+
+			uint8_t attr_lo = (attrib_0 & bit) ? 1 : 0;
+			uint8_t attr_hi = (attrib_1 & bit) ? 1 : 0;
+			bg_palette = (attr_hi << 3) | (attr_lo << 2);
+		}
+
+		uint8_t sprite = 0;
+		if (mask & MASK_SHOW_SPRITES) {
+			sprite = log->sprite_line[sprite_dots++];
+		}
+		uint8_t sprite_pixel = sprite & SPRITE_PIXEL;
+		uint8_t sprite_palette = sprite & SPRITE_PALETTE;
+
+		uint16_t output_palette_location = 0x00;
+		uint8_t output_pixel = bg_pixel;
+		uint8_t output_palette = bg_palette;
+
+		bool show_sprites = (mask & MASK_SHOW_SPRITES) && ((mask & MASK_SHOW_BACKGROUND_LEFT) || dot > 8);
+
+		if (show_sprites) {
+			if (bg_pixel == 0 && sprite_pixel != 0) {
+				output_pixel = sprite_pixel;
+				output_palette = sprite_palette;
+				output_palette_location = 0x10;
+			} else if (sprite_pixel != 0 && bg_pixel != 0) {
+				if ((sprite & SPRITE_BEHIND) == 0) {
+					output_pixel = sprite_pixel;
+					output_palette = sprite_palette;
+					output_palette_location = 0x10;
+				}
+			}
+		}
+
+		uint16_t palette_addr = output_palette_location | output_palette | output_pixel;
+		uint8_t palette_index = palette[(palette_addr & 0x3) == 0 ? 0 : (palette_addr & 0x1F)] & 0x3f;
+		if (gray) {
+			luma[dot - 1] = palette_luma[palette_index];
+			continue;
+		}
+		indices[dot - 1] = palette_index | ((uint16_t)(mask >> 5) << 6);
+		pixformat_t* pixel = &pixels[dot - 1];
+		const uint8_t* color = &palette_colors[palette_index * 3];
+		if (pixel->r != color[0] || pixel->g != color[1] || pixel->b != color[2]) {
+			pixel->r = color[0];
+			pixel->g = color[1];
+			pixel->b = color[2];
+			dirty |= (uint32_t)1 << ((dot - 1) >> 3);
+		}
+	}
+
+	if (gray) {
+		shrink_line(line, luma);
+	}
+	line_dirty[line] = dirty;
+}
+
+#ifdef CNES_VIDEO_THREAD
+// The PPU publishes lines a tile row at a time. Each thread claims the next tile row
+// that has been published and sleeps when there is none. Lines only depend on their
+// own log, so they can be drawn in any order.
+#define VIDEO_MAX_THREADS 16
+#define LINES_PER_CLAIM 8
+
+static thrd_t video_thread_pool[VIDEO_MAX_THREADS];
+static unsigned int video_threads_running = 0;
+static mtx_t video_lock;
+static cnd_t lines_published;
+static cnd_t lines_drawn_changed;
+static int lines_logged = 0;
+static int lines_ready = 0;
+static int lines_claimed = 0;
+static int lines_drawn = 0;
+static bool video_threads_quit = false;
+
+static int video_thread_main(void* unused) {
+	(void)unused;
+	mtx_lock(&video_lock);
+	for (;;) {
+		while (!video_threads_quit && lines_claimed == lines_ready) {
+			cnd_wait(&lines_published, &video_lock);
+		}
+		if (video_threads_quit) break;
+
+		int first = lines_claimed;
+		int last = first + LINES_PER_CLAIM < lines_ready ? first + LINES_PER_CLAIM : lines_ready;
+		lines_claimed = last;
+		mtx_unlock(&video_lock);
+		for (int line = first; line < last; line++) {
+			draw_line(line);
+		}
+		mtx_lock(&video_lock);
+		lines_drawn += last - first;
+		cnd_signal(&lines_drawn_changed);
+	}
+	mtx_unlock(&video_lock);
+	return 0;
+}
+
+static void stop_video_threads() {
+	mtx_lock(&video_lock);
+	video_threads_quit = true;
+	cnd_broadcast(&lines_published);
+	mtx_unlock(&video_lock);
+	for (unsigned int i = 0; i < video_threads_running; i++) {
+		thrd_join(video_thread_pool[i], NULL);
+	}
+	cnd_destroy(&lines_published);
+	cnd_destroy(&lines_drawn_changed);
+	mtx_destroy(&video_lock);
+	video_threads_running = 0;
+}
+
+static void start_video_threads(unsigned int count) {
+	if (mtx_init(&video_lock, mtx_plain) != thrd_success) return;
+	cnd_init(&lines_published);
+	cnd_init(&lines_drawn_changed);
+	video_threads_quit = false;
+	lines_ready = lines_claimed = lines_drawn = 0;
+	while (video_threads_running < count && thrd_create(&video_thread_pool[video_threads_running], video_thread_main, NULL) == thrd_success) {
+		video_threads_running++;
+	}
+	if (video_threads_running == 0) {
+		cnd_destroy(&lines_published);
+		cnd_destroy(&lines_drawn_changed);
+		mtx_destroy(&video_lock);
+	}
+}
+
+static void publish_lines(int count) {
+	mtx_lock(&video_lock);
+	lines_ready = count;
+	cnd_broadcast(&lines_published);
+	mtx_unlock(&video_lock);
+}
+#endif
+
+void video_begin_frame() {
+	unsigned int width = gray_width < 256 ? gray_width : 256;
+	unsigned int height = gray_height < 240 ? gray_height : 240;
+	if (width == 0 || height == 0) {
+		frame_gray_width = frame_gray_height = 0;
+	} else if (width != frame_gray_width || height != frame_gray_height) {
+		setup_gray(width, height);
+	}
+
+#ifdef CNES_VIDEO_THREAD
+	unsigned int wanted = video_threads < VIDEO_MAX_THREADS ? video_threads : VIDEO_MAX_THREADS;
+	if (wanted != video_threads_running) {
+		if (video_threads_running > 0) {
+			stop_video_threads();
+		}
+		if (wanted > 0) {
+			start_video_threads(wanted);
+		}
+	}
+
+	lines_logged = 0;
+	if (video_threads_running > 0) {
+		mtx_lock(&video_lock);
+		lines_ready = lines_claimed = lines_drawn = 0;
+		mtx_unlock(&video_lock);
+	}
+#endif
+}
+
+void video_line_logged(int line) {
+#ifdef CNES_VIDEO_THREAD
+	if (video_threads_running > 0) {
+		lines_logged = line + 1;
+		if (lines_logged % LINES_PER_CLAIM == 0) {
+			publish_lines(lines_logged);
+		}
+		return;
+	}
+#endif
+	draw_line(line);
+}
+
+void video_end_frame() {
+#ifdef CNES_VIDEO_THREAD
+	if (video_threads_running > 0) {
+		publish_lines(lines_logged);
+		mtx_lock(&video_lock);
+		while (lines_drawn != lines_logged) {
+			cnd_wait(&lines_drawn_changed, &video_lock);
+		}
+		mtx_unlock(&video_lock);
+	}
+#endif
+
+	if (frame_gray_width != 0) {
+		finish_gray();
+		return;
+	}
+	for (size_t line = 0; line < 240; line++) {
+		framebuffer_dirty[line >> 3] |= line_dirty[line];
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef _VIDEO_H_
+#define _VIDEO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Everything that decides the pixels of a visible line. It is recorded while the PPU
+// runs through the line, so the pixels can be drawn afterwards or on another thread.
+
+#define LINE_EVENT_MASK    0
+#define LINE_EVENT_FINE_X  1
+#define LINE_EVENT_PALETTE 2
+
+// The 256 visible dots are about 85 CPU cycles, at most 21 writes
+#define LINE_MAX_EVENTS 32
+
+typedef struct {
+	uint16_t dot;
+	uint8_t kind;
+	uint8_t index;
+	uint8_t value;
+} line_event_t;
+
+typedef struct {
+	// State at dot 1
+	uint16_t pattern_plane_0, pattern_plane_1;
+	uint16_t attrib_0, attrib_1;
+	uint8_t mask;
+	uint8_t fine_x_scroll;
+	uint8_t palette[32];
+	uint8_t sprite_line[256];
+
+	// next_pattern_lsb, next_pattern_msb and next_attribute for the shifter loads at dots 9, 17 ... 249
+	uint8_t loads[31][3];
+
+	// Writes made during the line, in order
+	size_t event_count;
+	line_event_t events[LINE_MAX_EVENTS];
+} line_log_t;
+
+// Bits of sprite_line
+#define SPRITE_PIXEL    0x03
+#define SPRITE_PALETTE  0x0C
+#define SPRITE_BEHIND   0x20
+#define SPRITE_ZERO     0x40
+
+extern line_log_t line_logs[240];
+
+void video_begin_frame();
+// line_logs[line] is complete and can be drawn
+void video_line_logged(int line);
+// Waits until every logged line is in the framebuffer
+void video_end_frame();
+
+#endif
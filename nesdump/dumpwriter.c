@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include "dumpwriter.h"
+#include "yuv.h"
+
+#define QUEUE_LENGTH 16
+#define MAX_SAMPLES_PER_FRAME 4096
+
+typedef struct {
+	pixformat_t frame[256 * 240];
+	int16_t samples[MAX_SAMPLES_PER_FRAME];
+	size_t sample_count;
+} dump_job_t;
+
+static dump_job_t* queue = NULL;
+static size_t queue_head = 0; // Next job to write
+static size_t queue_count = 0;
+static bool closing = false;
+static mtx_t queue_lock;
+static cnd_t queue_changed;
+static thrd_t writer;
+
+static FILE* y4m = NULL;
+static FILE* wav = NULL;
+static uint32_t wav_data_bytes = 0;
+static unsigned int wav_sample_rate = 0;
+static bool write_failed = false;
+
+static uint8_t y_plane[256 * 240];
+static uint8_t u_plane[128 * 120];
+static uint8_t v_plane[128 * 120];
+
+static void put_u16(uint8_t* at, uint16_t value) {
+	at[0] = (uint8_t)value;
+	at[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t* at, uint32_t value) {
+	put_u16(at, (uint16_t)value);
+	put_u16(at + 2, (uint16_t)(value >> 16));
+}
+
+static void write_wav_header() {
+	uint8_t header[44];
+	memcpy(header, "RIFF", 4);
+	put_u32(header + 4, 36 + wav_data_bytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_u32(header + 16, 16);
+	put_u16(header + 20, 1); // PCM
+	put_u16(header + 22, 1); // Mono
+	put_u32(header + 24, wav_sample_rate);
+	put_u32(header + 28, wav_sample_rate * 2);
+	put_u16(header + 32, 2);
+	put_u16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put_u32(header + 40, wav_data_bytes);
+
+	fseek(wav, 0, SEEK_SET);
+	if (fwrite(header, sizeof(header), 1, wav) != 1) write_failed = true;
+	fseek(wav, 0, SEEK_END);
+}
+
+static void write_job(dump_job_t* job) {
+	rgb_to_yuv420(job->frame, y_plane, u_plane, v_plane);
+	if (fputs("FRAME\n", y4m) < 0
+		|| fwrite(y_plane, sizeof(y_plane), 1, y4m) != 1
+		|| fwrite(u_plane, sizeof(u_plane), 1, y4m) != 1
+		|| fwrite(v_plane, sizeof(v_plane), 1, y4m) != 1) {
+		write_failed = true;
+	}
+
+	// WAV is little endian
+	uint8_t bytes[MAX_SAMPLES_PER_FRAME * 2];
+	for (size_t i = 0; i < job->sample_count; i++) {
+		put_u16(&bytes[i * 2], (uint16_t)job->samples[i]);
+	}
+	if (job->sample_count > 0 && fwrite(bytes, job->sample_count * 2, 1, wav) != 1) {
+		write_failed = true;
+	}
+	wav_data_bytes += (uint32_t)job->sample_count * 2;
+}
+
+static int writer_main(void* arg) {
+	(void)arg;
+	mtx_lock(&queue_lock);
+	for (;;) {
+		while (queue_count == 0 && !closing) {
+			cnd_wait(&queue_changed, &queue_lock);
+		}
+		if (queue_count == 0) break;
+
+		// The job stays in the queue while it is written so dump_frame can't reuse it
+		dump_job_t* job = &queue[queue_head];
+		mtx_unlock(&queue_lock);
+		write_job(job);
+		mtx_lock(&queue_lock);
+
+		queue_head = (queue_head + 1) % QUEUE_LENGTH;
+		queue_count--;
+		cnd_broadcast(&queue_changed);
+	}
+	mtx_unlock(&queue_lock);
+	return 0;
+}
+
+bool dump_open(const char* y4m_path, const char* wav_path, unsigned int sample_rate) {
+	queue = malloc(sizeof(dump_job_t) * QUEUE_LENGTH);
+	y4m = fopen(y4m_path, "wb");
+	wav = fopen(wav_path, "wb");
+	if (!queue || !y4m || !wav) {
+		free(queue);
+		if (y4m) fclose(y4m);
+		if (wav) fclose(wav);
+		return false;
+	}
+
+	// NTSC NES runs at 39375000 / 655171 (~60.0988) fps with 8:7 pixels
+	fputs("YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C420jpeg\n", y4m);
+	wav_sample_rate = sample_rate;
+	wav_data_bytes = 0;
+	write_wav_header();
+
+	queue_head = 0;
+	queue_count = 0;
+	closing = false;
+	write_failed = false;
+	mtx_init(&queue_lock, mtx_plain);
+	cnd_init(&queue_changed);
+	thrd_create(&writer, writer_main, NULL);
+	return true;
+}
+
+void dump_frame(const pixformat_t* frame, const int16_t* samples, size_t sample_count) {
+	mtx_lock(&queue_lock);
+	while (queue_count == QUEUE_LENGTH) {
+		cnd_wait(&queue_changed, &queue_lock);
+	}
+	dump_job_t* job = &queue[(queue_head + queue_count) % QUEUE_LENGTH];
+	mtx_unlock(&queue_lock);
+
+	// Only the writer thread touches queue_head, and it never gets to this slot before it is queued
+	memcpy(job->frame, frame, sizeof(job->frame));
+	if (sample_count > MAX_SAMPLES_PER_FRAME) sample_count = MAX_SAMPLES_PER_FRAME;
+	memcpy(job->samples, samples, sample_count * sizeof(int16_t));
+	job->sample_count = sample_count;
+
+	mtx_lock(&queue_lock);
+	queue_count++;
+	cnd_broadcast(&queue_changed);
+	mtx_unlock(&queue_lock);
+}
+
+bool dump_close() {
+	mtx_lock(&queue_lock);
+	closing = true;
+	cnd_broadcast(&queue_changed);
+	mtx_unlock(&queue_lock);
+	thrd_join(writer, NULL);
+
+	write_wav_header();
+	bool ok = !write_failed;
+	if (fclose(y4m) != 0) ok = false;
+	if (fclose(wav) != 0) ok = false;
+	mtx_destroy(&queue_lock);
+	cnd_destroy(&queue_changed);
+	free(queue);
+	return ok;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <cnes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Frames are converted and written on a separate thread, dump_frame only blocks if the writer falls behind
+	bool dump_open(const char* y4m_path, const char* wav_path, unsigned int sample_rate);
+	void dump_frame(const pixformat_t* frame, const int16_t* samples, size_t sample_count);
+	// Waits for everything queued to be written, returns false if any write failed
+	bool dump_close();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <cnes.h>
+
+#include "dumpwriter.h"
+
+#define SAMPLE_RATE 48000
+
+// Renders a ROM, optionally driven by recorded input, to Y4M video and WAV audio
+// without a window. The input file holds two bytes per frame, one buttons_down
+// byte for each controller.
+
+int main(int argc, char** argv) {
+	if (argc < 5) {
+		fprintf(stderr, "usage: nesdump <rom.nes> <frames> <out.y4m> <out.wav> [input]\n");
+		fprintf(stderr, "  frames can be 0 to run until the input runs out\n");
+		return 1;
+	}
+
+	size_t rom_size = 0;
+	char* rom = cnes_read_file(argv[1], &rom_size);
+	if (!rom) {
+		fprintf(stderr, "Failed to read %s\n", argv[1]);
+		return 1;
+	}
+
+	long frames = atol(argv[2]);
+	size_t input_size = 0;
+	uint8_t* input = NULL;
+	if (argc > 5) {
+		input = (uint8_t*)cnes_read_file(argv[5], &input_size);
+		if (!input) {
+			fprintf(stderr, "Failed to read %s\n", argv[5]);
+			return 1;
+		}
+		if (frames == 0) frames = (long)(input_size / 2);
+	}
+
+	audio_mode = AUDIO_DECIMATED;
+	audio_sample_rate = SAMPLE_RATE;
+	int loaded = cnes_check_ines(rom, rom_size);
+	if (loaded == CNES_LOAD_NO_ERR) loaded = load_ines(rom);
+	if (loaded != CNES_LOAD_NO_ERR) {
+		fprintf(stderr, loaded == CNES_LOAD_NOT_INES ? "Not an iNES file!\n" : "Mapper not supported!\n");
+		return 1;
+	}
+
+	if (!dump_open(argv[3], argv[4], SAMPLE_RATE)) {
+		fprintf(stderr, "Failed to open output files\n");
+		return 1;
+	}
+
+	static int16_t samples[4096];
+	clock_t start = clock();
+	for (long frame = 0; frame < frames; frame++) {
+		if ((size_t)(frame + 1) * 2 <= input_size) {
+			buttons_down[0] = input[frame * 2];
+			buttons_down[1] = input[frame * 2 + 1];
+		}
+
+		tick_frame();
+		size_t sample_count = cnes_audio_read(samples, sizeof(samples) / sizeof(samples[0]));
+		dump_frame(framebuffer, samples, sample_count);
+	}
+
+	bool ok = dump_close();
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	fprintf(stderr, "%ld frames in %.2fs (%.1f fps)\n", frames, seconds, seconds > 0 ? frames / seconds : 0);
+
+	free(input);
+	free(rom);
+	if (!ok) {
+		fprintf(stderr, "Writing the output failed\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include "yuv.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+#define WIDTH 256
+#define HEIGHT 240
+
+// All sums stay within 0..65535 so the math works on unsigned 16 bit lanes,
+// negative coefficients just wrap around until the offset brings them back
+#define Y_R 66
+#define Y_G 129
+#define Y_B 25
+#define Y_OFFSET (128 + (16 << 8))
+#define U_R ((uint16_t)-38)
+#define U_G ((uint16_t)-74)
+#define U_B 112
+#define V_R 112
+#define V_G ((uint16_t)-94)
+#define V_B ((uint16_t)-18)
+#define UV_OFFSET (128 + (128 << 8))
+
+// Converts count (a multiple of 8) planar 16 bit colors with the given coefficients
+static void convert(const uint16_t* r, const uint16_t* g, const uint16_t* b, uint8_t* out, int count, uint16_t cr, uint16_t cg, uint16_t cb, uint16_t offset) {
+#ifdef USE_SSE2
+	const __m128i kr = _mm_set1_epi16((short)cr);
+	const __m128i kg = _mm_set1_epi16((short)cg);
+	const __m128i kb = _mm_set1_epi16((short)cb);
+	const __m128i ko = _mm_set1_epi16((short)offset);
+	for (int i = 0; i < count; i += 16) {
+		__m128i sums[2];
+		for (int half = 0; half < 2; half++) {
+			int at = i + half * 8;
+			__m128i sum = _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)&r[at]), kr);
+			sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)&g[at]), kg));
+			sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)&b[at]), kb));
+			sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, ko), 8);
+		}
+		_mm_storeu_si128((__m128i*)&out[i], _mm_packus_epi16(sums[0], sums[1]));
+	}
+#else
+	for (int i = 0; i < count; i++) {
+		uint16_t sum = (uint16_t)(r[i] * cr + g[i] * cg + b[i] * cb + offset);
+		out[i] = (uint8_t)(sum >> 8);
+	}
+#endif
+}
+
+void rgb_to_yuv420(const pixformat_t* rgb, uint8_t* y_plane, uint8_t* u_plane, uint8_t* v_plane) {
+	uint16_t r[WIDTH], g[WIDTH], b[WIDTH];
+	uint16_t cr[WIDTH / 2], cg[WIDTH / 2], cb[WIDTH / 2];
+
+	for (int y = 0; y < HEIGHT; y++) {
+		const pixformat_t* row = &rgb[y * WIDTH];
+		for (int x = 0; x < WIDTH; x++) {
+			r[x] = row[x].r;
+			g[x] = row[x].g;
+			b[x] = row[x].b;
+		}
+		convert(r, g, b, &y_plane[y * WIDTH], WIDTH, Y_R, Y_G, Y_B, Y_OFFSET);
+
+		if (y & 1) {
+			const pixformat_t* above = row - WIDTH;
+			for (int x = 0; x < WIDTH / 2; x++) {
+				cr[x] = (above[2 * x].r + above[2 * x + 1].r + row[2 * x].r + row[2 * x + 1].r + 2) >> 2;
+				cg[x] = (above[2 * x].g + above[2 * x + 1].g + row[2 * x].g + row[2 * x + 1].g + 2) >> 2;
+				cb[x] = (above[2 * x].b + above[2 * x + 1].b + row[2 * x].b + row[2 * x + 1].b + 2) >> 2;
+			}
+			convert(cr, cg, cb, &u_plane[(y / 2) * (WIDTH / 2)], WIDTH / 2, U_R, U_G, U_B, UV_OFFSET);
+			convert(cr, cg, cb, &v_plane[(y / 2) * (WIDTH / 2)], WIDTH / 2, V_R, V_G, V_B, UV_OFFSET);
+		}
+	}
+}
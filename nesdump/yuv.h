@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+#include <cnes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// BT.601 limited range, chroma is the average of each 2x2 block
+	void rgb_to_yuv420(const pixformat_t* rgb, uint8_t* y_plane, uint8_t* u_plane, uint8_t* v_plane);
+
+#ifdef __cplusplus
+}
+#endif
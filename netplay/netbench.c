@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <cnes.h>
+
+#include "transport.h"
+#include "rollback.h"
+
+#define FRAME_MS (1000.0 / 60.0988)
+
+// Plays both sides of a rollback session in one process over a simulated link and
+// reports how much re-simulation it took. The players hold random buttons for random
+// stretches, like people do, so some predictions are right and some are not.
+
+typedef struct {
+	uint32_t random;
+	uint8_t buttons;
+	int hold;
+} player_t;
+
+static uint8_t next_buttons(player_t* player) {
+	if (player->hold-- <= 0) {
+		player->random = player->random * 1103515245 + 12345;
+		player->buttons = (uint8_t)(player->random >> 16);
+		player->hold = 1 + (player->random >> 8) % 30;
+	}
+	return player->buttons;
+}
+
+static void print_stats(int side, const rollback_stats_t* stats) {
+	printf("peer %d: %u frames, %u stalls, %u rollbacks, %u re-simulated frames (%.1f per second), %u checksums compared, %u desyncs\n",
+		side, stats->frames, stats->stalls, stats->rollbacks, stats->resimulated_frames,
+		stats->resimulation_seconds > 0 ? stats->resimulated_frames / stats->resimulation_seconds : 0.0,
+		stats->checksums_compared, stats->desyncs);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: netbench <rom.nes> [frames] [rtt ms] [jitter ms] [loss]\n");
+		fprintf(stderr, "  defaults to 3600 frames, 100 ms, 10 ms and 0.02\n");
+		return 1;
+	}
+
+	size_t rom_size = 0;
+	char* rom = cnes_read_file(argv[1], &rom_size);
+	if (!rom) {
+		fprintf(stderr, "Failed to read %s\n", argv[1]);
+		return 1;
+	}
+	uint32_t frames = argc > 2 ? (uint32_t)atol(argv[2]) : 3600;
+	double rtt = argc > 3 ? atof(argv[3]) : 100;
+	double jitter = argc > 4 ? atof(argv[4]) : 10;
+	double loss = argc > 5 ? atof(argv[5]) : 0.02;
+
+	int loaded = cnes_check_ines(rom, rom_size);
+	if (loaded == CNES_LOAD_NO_ERR) loaded = load_ines(rom);
+	if (loaded != CNES_LOAD_NO_ERR) {
+		fprintf(stderr, loaded == CNES_LOAD_NOT_INES ? "Not an iNES file!\n" : "Mapper not supported!\n");
+		return 1;
+	}
+
+	net_link_t* link = net_link_create(rtt / 2, jitter, loss, 12345);
+	rollback_session_t* sessions[2];
+	player_t players[2] = { { 1, 0, 0 }, { 2, 0, 0 } };
+	uint8_t held[2];
+	for (int side = 0; side < 2; side++) {
+		sessions[side] = rollback_create(net_link_endpoint(link, side), side);
+		if (!sessions[side]) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		held[side] = next_buttons(&players[side]);
+	}
+
+	static int16_t samples[4096];
+	clock_t start = clock();
+	while (rollback_stats(sessions[0])->frames < frames || rollback_stats(sessions[1])->frames < frames) {
+		for (int side = 0; side < 2; side++) {
+			if (rollback_stats(sessions[side])->frames >= frames) continue;
+			if (rollback_advance(sessions[side], held[side])) {
+				held[side] = next_buttons(&players[side]);
+			}
+			cnes_audio_read(samples, sizeof(samples) / sizeof(samples[0]));
+		}
+		net_link_advance(link, FRAME_MS);
+	}
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("%.0f ms rtt, %.0f ms jitter, %.1f%% loss\n", rtt, jitter, loss * 100);
+	uint32_t desyncs = 0;
+	uint32_t total = 0;
+	for (int side = 0; side < 2; side++) {
+		const rollback_stats_t* stats = rollback_stats(sessions[side]);
+		print_stats(side, stats);
+		desyncs += stats->desyncs;
+		total += stats->frames + stats->resimulated_frames;
+	}
+	printf("%u frames emulated in %.2fs (%.1f fps)\n", total, seconds, seconds > 0 ? total / seconds : 0);
+
+	for (int side = 0; side < 2; side++) {
+		rollback_destroy(sessions[side]);
+	}
+	net_link_destroy(link);
+	free(rom);
+	return desyncs == 0 ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cnes.h>
+#include "rollback.h"
+
+#define INPUT_RING 128
+#define MAX_INPUTS_PER_PACKET 64
+#define CHECKSUM_SLOTS 8
+
+#define PACKET_INPUT 1
+#define PACKET_CHECKSUM 2
+
+typedef struct {
+	uint32_t frame;
+	uint64_t hash;
+	bool valid;
+} checksum_t;
+
+struct rollback_session {
+	net_transport_t* transport;
+	int local_player;
+
+	uint32_t frame; // The next frame to run
+	uint8_t local_inputs[INPUT_RING];
+	// Actual input below remote_frames, the prediction that was used above it
+	uint8_t remote_inputs[INPUT_RING];
+	uint32_t remote_frames;       // Remote input has arrived for every frame before this
+	uint32_t remote_acked;        // The remote has our input for every frame before this
+	uint32_t rollback_from;       // First frame that ran on a wrong prediction, or UINT32_MAX
+
+	// The state before each of the last ROLLBACK_MAX_FRAMES + 1 frames
+	uint8_t* snapshots;
+	size_t state_size;
+	// cnes_state_hash of the snapshots taken before a checksummed frame
+	uint64_t hashes[ROLLBACK_MAX_FRAMES + 1];
+
+	uint32_t next_checksum;
+	checksum_t local_checksums[CHECKSUM_SLOTS];
+	checksum_t remote_checksums[CHECKSUM_SLOTS];
+
+	rollback_stats_t stats;
+};
+
+// The session whose state is in the emulator
+static rollback_session_t* active_session = NULL;
+
+static uint8_t* snapshot(rollback_session_t* session, uint32_t frame) {
+	return session->snapshots + (frame % (ROLLBACK_MAX_FRAMES + 1)) * session->state_size;
+}
+
+static void save_snapshot(rollback_session_t* session, uint32_t frame) {
+	cnes_save_state_to(snapshot(session, frame));
+	if (frame % ROLLBACK_CHECKSUM_INTERVAL == 0) {
+		session->hashes[frame % (ROLLBACK_MAX_FRAMES + 1)] = cnes_state_hash();
+	}
+}
+
+static void load_snapshot(rollback_session_t* session, uint32_t frame) {
+	cnes_load_state_from(snapshot(session, frame));
+	active_session = session;
+}
+
+static void write_u32(uint8_t* at, uint32_t value) {
+	for (size_t i = 0; i < 4; i++) at[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint32_t read_u32(const uint8_t* at) {
+	return (uint32_t)at[0] | ((uint32_t)at[1] << 8) | ((uint32_t)at[2] << 16) | ((uint32_t)at[3] << 24);
+}
+
+rollback_session_t* rollback_create(net_transport_t* transport, int local_player) {
+	rollback_session_t* session = calloc(1, sizeof(rollback_session_t));
+	if (!session) return NULL;
+
+	session->state_size = cnes_state_size();
+	session->snapshots = malloc(session->state_size * (ROLLBACK_MAX_FRAMES + 1));
+	if (!session->snapshots) {
+		free(session);
+		return NULL;
+	}
+
+	session->transport = transport;
+	session->local_player = local_player ? 1 : 0;
+	session->rollback_from = UINT32_MAX;
+	session->next_checksum = ROLLBACK_CHECKSUM_INTERVAL;
+	save_snapshot(session, 0);
+	active_session = session;
+	return session;
+}
+
+void rollback_destroy(rollback_session_t* session) {
+	if (!session) return;
+	if (active_session == session) active_session = NULL;
+	free(session->snapshots);
+	free(session);
+}
+
+const rollback_stats_t* rollback_stats(const rollback_session_t* session) {
+	return &session->stats;
+}
+
+static void compare_checksums(rollback_session_t* session, size_t slot) {
+	checksum_t* local = &session->local_checksums[slot];
+	checksum_t* remote = &session->remote_checksums[slot];
+	if (local->valid && remote->valid && local->frame == remote->frame) {
+		session->stats.checksums_compared++;
+		if (local->hash != remote->hash) {
+			session->stats.desyncs++;
+		}
+		local->valid = remote->valid = false;
+	}
+}
+
+static void receive_inputs(rollback_session_t* session, const uint8_t* packet, size_t size) {
+	if (size < 10) return;
+	uint32_t first = read_u32(packet + 1);
+	uint32_t acked = read_u32(packet + 5);
+	size_t count = packet[9];
+	if (size < 10 + count) return;
+
+	if (acked > session->remote_acked && acked <= session->frame) {
+		session->remote_acked = acked;
+	}
+
+	// Only input that continues what has arrived so far is used, later input is sent again
+	if (first > session->remote_frames) return;
+	for (uint32_t frame = session->remote_frames; frame < first + count; frame++) {
+		uint8_t buttons = packet[10 + (frame - first)];
+		uint8_t* used = &session->remote_inputs[frame % INPUT_RING];
+		if (frame < session->frame && *used != buttons && frame < session->rollback_from) {
+			session->rollback_from = frame;
+		}
+		*used = buttons;
+		session->remote_frames = frame + 1;
+	}
+}
+
+static void receive_checksum(rollback_session_t* session, const uint8_t* packet, size_t size) {
+	if (size < 13) return;
+	uint32_t frame = read_u32(packet + 1);
+	uint64_t hash = (uint64_t)read_u32(packet + 5) | ((uint64_t)read_u32(packet + 9) << 32);
+
+	size_t slot = (frame / ROLLBACK_CHECKSUM_INTERVAL) % CHECKSUM_SLOTS;
+	session->remote_checksums[slot].frame = frame;
+	session->remote_checksums[slot].hash = hash;
+	session->remote_checksums[slot].valid = true;
+	compare_checksums(session, slot);
+}
+
+static void poll_network(rollback_session_t* session) {
+	uint8_t packet[NET_MAX_PACKET];
+	size_t size;
+	while ((size = session->transport->receive(session->transport, packet, sizeof(packet))) > 0) {
+		if (packet[0] == PACKET_INPUT) {
+			receive_inputs(session, packet, size);
+		} else if (packet[0] == PACKET_CHECKSUM) {
+			receive_checksum(session, packet, size);
+		}
+	}
+}
+
+static void send_inputs(rollback_session_t* session) {
+	// Everything the remote hasn't confirmed, so a lost packet is made up for by the next one
+	uint32_t first = session->remote_acked;
+	if (session->frame - first > MAX_INPUTS_PER_PACKET) {
+		first = session->frame - MAX_INPUTS_PER_PACKET;
+	}
+	size_t count = session->frame - first;
+
+	uint8_t packet[10 + MAX_INPUTS_PER_PACKET];
+	packet[0] = PACKET_INPUT;
+	write_u32(packet + 1, first);
+	write_u32(packet + 5, session->remote_frames);
+	packet[9] = (uint8_t)count;
+	for (size_t i = 0; i < count; i++) {
+		packet[10 + i] = session->local_inputs[(first + i) % INPUT_RING];
+	}
+	session->transport->send(session->transport, packet, 10 + count);
+}
+
+static uint8_t predicted_input(rollback_session_t* session) {
+	if (session->remote_frames == 0) return 0;
+	return session->remote_inputs[(session->remote_frames - 1) % INPUT_RING];
+}
+
+static void run_frame(rollback_session_t* session, uint32_t frame) {
+	if (frame >= session->remote_frames) {
+		session->remote_inputs[frame % INPUT_RING] = predicted_input(session);
+	}
+	buttons_down[session->local_player] = session->local_inputs[frame % INPUT_RING];
+	buttons_down[!session->local_player] = session->remote_inputs[frame % INPUT_RING];
+	tick_frame();
+	save_snapshot(session, frame + 1);
+}
+
+static void roll_back(rollback_session_t* session) {
+	clock_t start = clock();
+	bool video = video_output_enabled;
+	video_output_enabled = false;
+	load_snapshot(session, session->rollback_from);
+
+	int16_t discarded[1024];
+	for (uint32_t frame = session->rollback_from; frame < session->frame; frame++) {
+		run_frame(session, frame);
+		// These frames were heard the first time round
+		while (cnes_audio_read(discarded, sizeof(discarded) / sizeof(discarded[0])) > 0) {
+		}
+		session->stats.resimulated_frames++;
+	}
+
+	video_output_enabled = video;
+	session->stats.rollbacks++;
+	session->rollback_from = UINT32_MAX;
+	session->stats.resimulation_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void send_checksums(rollback_session_t* session) {
+	// The state before a frame is final once every input before it is known
+	uint32_t confirmed = session->remote_frames < session->frame ? session->remote_frames : session->frame;
+	while (session->next_checksum <= confirmed) {
+		uint32_t frame = session->next_checksum;
+		session->next_checksum += ROLLBACK_CHECKSUM_INTERVAL;
+		if (frame + ROLLBACK_MAX_FRAMES < session->frame) continue;
+
+		uint64_t hash = session->hashes[frame % (ROLLBACK_MAX_FRAMES + 1)];
+		size_t slot = (frame / ROLLBACK_CHECKSUM_INTERVAL) % CHECKSUM_SLOTS;
+		session->local_checksums[slot].frame = frame;
+		session->local_checksums[slot].hash = hash;
+		session->local_checksums[slot].valid = true;
+		compare_checksums(session, slot);
+
+		uint8_t packet[13];
+		packet[0] = PACKET_CHECKSUM;
+		write_u32(packet + 1, frame);
+		write_u32(packet + 5, (uint32_t)hash);
+		write_u32(packet + 9, (uint32_t)(hash >> 32));
+		session->transport->send(session->transport, packet, sizeof(packet));
+	}
+}
+
+bool rollback_advance(rollback_session_t* session, uint8_t local_buttons) {
+	poll_network(session);
+
+	if (session->frame >= session->remote_frames + ROLLBACK_MAX_FRAMES) {
+		session->stats.stalls++;
+		send_inputs(session);
+		return false;
+	}
+
+	if (session->rollback_from != UINT32_MAX) {
+		roll_back(session);
+	} else if (active_session != session) {
+		load_snapshot(session, session->frame);
+	}
+	send_checksums(session);
+
+	session->local_inputs[session->frame % INPUT_RING] = local_buttons;
+	run_frame(session, session->frame);
+	session->frame++;
+	session->stats.frames++;
+
+	send_inputs(session);
+	return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// How many frames the local side may run on predicted remote input
+	#define ROLLBACK_MAX_FRAMES 16
+	// Frames between state checksums compared with the remote
+	#define ROLLBACK_CHECKSUM_INTERVAL 30
+
+	typedef struct {
+		uint32_t frames;             // Frames advanced
+		uint32_t stalls;             // Calls that ran nothing because the remote was too far behind
+		uint32_t rollbacks;
+		uint32_t resimulated_frames;
+		double resimulation_seconds; // CPU time spent re-simulating
+		uint32_t checksums_compared;
+		uint32_t desyncs;            // Checksums that didn't match the remote's
+	} rollback_stats_t;
+
+	typedef struct rollback_session rollback_session_t;
+
+	// Starts a session from the current machine state, which must be the same on both
+	// peers. local_player is 0 or 1, the remote peer plays the other one. Several
+	// sessions can share the emulator in one process, each keeps its own state.
+	rollback_session_t* rollback_create(net_transport_t* transport, int local_player);
+	void rollback_destroy(rollback_session_t* session);
+	// Runs the next frame with the local player's buttons. Remote input that hasn't
+	// arrived yet is predicted to stay the same; when it turns out different, the frames
+	// since are re-simulated first. Only the new frame is drawn and heard, and its audio
+	// should be read before the next call. Returns false, without running anything,
+	// when the remote is ROLLBACK_MAX_FRAMES behind. Give the same buttons again next time
+	bool rollback_advance(rollback_session_t* session, uint8_t local_buttons);
+	const rollback_stats_t* rollback_stats(const rollback_session_t* session);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include "transport.h"
+
+typedef struct packet {
+	double arrives_at;
+	size_t size;
+	uint8_t data[NET_MAX_PACKET];
+	struct packet* next;
+} packet_t;
+
+typedef struct {
+	net_transport_t transport; // First, so endpoint and transport pointers are the same
+	net_link_t* link;
+	packet_t* incoming;        // Sorted by arrival time
+} endpoint_t;
+
+struct net_link {
+	double now;
+	double latency;
+	double jitter;
+	double loss;
+	uint32_t random;
+	endpoint_t ends[2];
+};
+
+static double next_random(net_link_t* link) {
+	// xorshift32
+	link->random ^= link->random << 13;
+	link->random ^= link->random >> 17;
+	link->random ^= link->random << 5;
+	return (double)link->random / 4294967296.0;
+}
+
+static void link_send(net_transport_t* transport, const void* data, size_t size) {
+	endpoint_t* from = (endpoint_t*)transport;
+	net_link_t* link = from->link;
+	endpoint_t* to = &link->ends[from == &link->ends[0] ? 1 : 0];
+
+	if (size > NET_MAX_PACKET || next_random(link) < link->loss) return;
+
+	packet_t* packet = malloc(sizeof(packet_t));
+	if (!packet) return;
+	packet->arrives_at = link->now + link->latency + link->jitter * next_random(link);
+	packet->size = size;
+	memcpy(packet->data, data, size);
+
+	packet_t** at = &to->incoming;
+	while (*at && (*at)->arrives_at <= packet->arrives_at) {
+		at = &(*at)->next;
+	}
+	packet->next = *at;
+	*at = packet;
+}
+
+static size_t link_receive(net_transport_t* transport, void* data, size_t capacity) {
+	endpoint_t* end = (endpoint_t*)transport;
+	packet_t* packet = end->incoming;
+	if (!packet || packet->arrives_at > end->link->now) return 0;
+
+	end->incoming = packet->next;
+	size_t size = packet->size < capacity ? packet->size : capacity;
+	memcpy(data, packet->data, size);
+	free(packet);
+	return size;
+}
+
+net_link_t* net_link_create(double latency_ms, double jitter_ms, double loss, uint32_t seed) {
+	net_link_t* link = calloc(1, sizeof(net_link_t));
+	if (!link) return NULL;
+
+	link->latency = latency_ms;
+	link->jitter = jitter_ms;
+	link->loss = loss;
+	link->random = seed ? seed : 1;
+	for (size_t i = 0; i < 2; i++) {
+		link->ends[i].transport.send = link_send;
+		link->ends[i].transport.receive = link_receive;
+		link->ends[i].link = link;
+	}
+	return link;
+}
+
+net_link_t* net_loopback_create() {
+	return net_link_create(0, 0, 0, 1);
+}
+
+void net_link_destroy(net_link_t* link) {
+	if (!link) return;
+	for (size_t i = 0; i < 2; i++) {
+		while (link->ends[i].incoming) {
+			packet_t* next = link->ends[i].incoming->next;
+			free(link->ends[i].incoming);
+			link->ends[i].incoming = next;
+		}
+	}
+	free(link);
+}
+
+net_transport_t* net_link_endpoint(net_link_t* link, int side) {
+	return &link->ends[side ? 1 : 0].transport;
+}
+
+void net_link_advance(net_link_t* link, double ms) {
+	link->now += ms;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define NET_MAX_PACKET 512
+
+	// Unreliable, unordered datagrams to the other peer. A real socket transport only
+	// has to provide these two functions.
+	typedef struct net_transport {
+		void (*send)(struct net_transport* transport, const void* data, size_t size);
+		// Copies the next packet that has arrived into data and returns its size, 0 when there is none
+		size_t (*receive)(struct net_transport* transport, void* data, size_t capacity);
+	} net_transport_t;
+
+	// Two endpoints in the same process. Each packet takes latency_ms plus up to jitter_ms
+	// to arrive, so packets can overtake each other, and is dropped with probability loss.
+	// Time only moves with net_link_advance.
+	typedef struct net_link net_link_t;
+
+	net_link_t* net_link_create(double latency_ms, double jitter_ms, double loss, uint32_t seed);
+	// Packets arrive as soon as they are sent
+	net_link_t* net_loopback_create();
+	void net_link_destroy(net_link_t* link);
+	net_transport_t* net_link_endpoint(net_link_t* link, int side);
+	void net_link_advance(net_link_t* link, double ms);
+
+#ifdef __cplusplus
+}
+#endif
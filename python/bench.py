@@ -0,0 +1,47 @@
+"""Measures what the bindings add to a step, and steps per second of a VecEnv.
+
+usage: python bench.py <rom.nes> [envs] [workers] [frameskip]
+Build the module first, then run with the build directory on PYTHONPATH.
+"""
+import sys
+import time
+
+import cnes
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 1
+    envs = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+    workers = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    frameskip = int(sys.argv[4]) if len(sys.argv) > 4 else 4
+
+    with open(sys.argv[1], 'rb') as f:
+        cnes.load(f.read())
+
+    # A step of no frames is all binding: argument parsing, the GIL, the lock and the result
+    env = cnes.Env(render=False)
+    count = 200000
+    start = time.perf_counter()
+    for _ in range(count):
+        env.step(0, 0)
+    print('%.2f us per step spent outside the emulator' % ((time.perf_counter() - start) / count * 1e6))
+    del env
+
+    vec = cnes.VecEnv(envs, workers, gray=(84, 84), max_frames=3600)
+    actions = bytearray(envs)
+    steps = 300
+    start = time.perf_counter()
+    for step in range(steps):
+        for i in range(envs):
+            actions[i] = (step * 7 + i * 13) & 0xFF
+        vec.step(actions, frameskip)
+    seconds = time.perf_counter() - start
+    print('%d environments, %d workers, frameskip %d: %.0f steps per second'
+          % (envs, workers, frameskip, steps * envs / seconds))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,681 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cnes.h>
+
+#include "env.h"
+#include "vecenv.h"
+
+// Python bindings over rlenv. Observations are handed out as read-only memoryviews of
+// the storage each environment keeps, nothing is copied on the way to Python. Stepping lets
+// go of the GIL; the emulator is one per process, so steps of environments in this
+// process still take turns, while VecEnv workers run in parallel.
+
+static PyThread_type_lock emulator_lock = NULL;
+static char* rom = NULL;
+// Bumped by every load, environments made before it can't run any more
+static unsigned int rom_generation = 0;
+
+/***** VIEWS *****/
+
+typedef struct {
+	PyObject_HEAD
+	PyObject* owner;  // Keeps the memory alive
+	void* data;
+	Py_ssize_t itemsize;
+	const char* format;
+	int ndim;
+	Py_ssize_t shape[3];
+	Py_ssize_t strides[3];
+} view_object_t;
+
+static int view_getbuffer(PyObject* self, Py_buffer* buffer, int flags) {
+	view_object_t* view = (view_object_t*)self;
+	if (flags & PyBUF_WRITABLE) {
+		PyErr_SetString(PyExc_BufferError, "cnes views are read-only");
+		buffer->obj = NULL;
+		return -1;
+	}
+	Py_ssize_t length = view->itemsize;
+	for (int i = 0; i < view->ndim; i++) length *= view->shape[i];
+
+	buffer->buf = view->data;
+	buffer->obj = Py_NewRef(self);
+	buffer->len = length;
+	buffer->readonly = 1;
+	buffer->itemsize = view->itemsize;
+	buffer->format = (flags & PyBUF_FORMAT) ? (char*)view->format : NULL;
+	buffer->ndim = view->ndim;
+	buffer->shape = (flags & PyBUF_ND) ? view->shape : NULL;
+	buffer->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? view->strides : NULL;
+	buffer->suboffsets = NULL;
+	buffer->internal = NULL;
+	return 0;
+}
+
+static void view_dealloc(PyObject* self) {
+	Py_XDECREF(((view_object_t*)self)->owner);
+	Py_TYPE(self)->tp_free(self);
+}
+
+static PyBufferProcs view_buffer_procs = { view_getbuffer, NULL };
+
+static PyTypeObject view_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "cnes._View",
+	.tp_basicsize = sizeof(view_object_t),
+	.tp_dealloc = view_dealloc,
+	.tp_as_buffer = &view_buffer_procs,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+};
+
+// A memoryview of rows x columns x channels items, trailing dimensions of 1 are left out
+static PyObject* make_view(PyObject* owner, const void* data, const char* format, Py_ssize_t itemsize,
+	Py_ssize_t rows, Py_ssize_t columns, Py_ssize_t channels) {
+	if (!data) Py_RETURN_NONE;
+	view_object_t* view = PyObject_New(view_object_t, &view_type);
+	if (!view) return NULL;
+	view->owner = Py_XNewRef(owner);
+	view->data = (void*)data;
+	view->itemsize = itemsize;
+	view->format = format;
+
+	Py_ssize_t dimensions[3] = { rows, columns, channels };
+	view->ndim = channels > 1 ? 3 : columns > 1 ? 2 : 1;
+	Py_ssize_t stride = itemsize;
+	for (int i = view->ndim - 1; i >= 0; i--) {
+		view->shape[i] = dimensions[i];
+		view->strides[i] = stride;
+		stride *= dimensions[i];
+	}
+
+	PyObject* memoryview = PyMemoryView_FromObject((PyObject*)view);
+	Py_DECREF(view);
+	return memoryview;
+}
+
+/***** CONFIG *****/
+
+static bool parse_predicate(PyObject* item, cnes_env_predicate_t* predicate) {
+	unsigned int address, mask, value;
+	const char* compare;
+	if (!PyArg_ParseTuple(item, "IIsI", &address, &mask, &compare, &value)) return false;
+
+	predicate->address = (uint16_t)address;
+	predicate->mask = (uint8_t)mask;
+	predicate->value = (uint8_t)value;
+	if (strcmp(compare, "==") == 0) {
+		predicate->compare = CNES_ENV_EQUAL;
+	} else if (strcmp(compare, "!=") == 0) {
+		predicate->compare = CNES_ENV_NOT_EQUAL;
+	} else if (strcmp(compare, "<") == 0) {
+		predicate->compare = CNES_ENV_LESS;
+	} else if (strcmp(compare, ">") == 0) {
+		predicate->compare = CNES_ENV_GREATER;
+	} else {
+		PyErr_Format(PyExc_ValueError, "unknown comparison '%s', use ==, !=, < or >", compare);
+		return false;
+	}
+	return true;
+}
+
+// The keyword arguments both Env and VecEnv take
+typedef struct {
+	double sticky;
+	unsigned int noop_max;
+	unsigned int max_frames;
+	int render;
+	PyObject* gray;
+	int audio;
+	PyObject* predicates;
+} config_args_t;
+
+static void default_config_args(config_args_t* args) {
+	args->sticky = cnes_env_default_config().sticky_probability;
+	args->noop_max = 0;
+	args->max_frames = 0;
+	args->render = 1;
+	args->gray = Py_None;
+	args->audio = AUDIO_OFF;
+	args->predicates = NULL;
+}
+
+static bool make_config(const config_args_t* args, cnes_env_config_t* config) {
+	*config = cnes_env_default_config();
+	if (!(args->sticky >= 0 && args->sticky <= 1)) {
+		PyErr_SetString(PyExc_ValueError, "sticky must be between 0 and 1");
+		return false;
+	}
+	config->sticky_probability = (float)args->sticky;
+	config->max_noop_frames = args->noop_max;
+	config->max_episode_frames = args->max_frames;
+	config->render = args->render != 0;
+	if (args->audio < AUDIO_FULL || args->audio > AUDIO_OFF) {
+		PyErr_SetString(PyExc_ValueError, "audio must be AUDIO_FULL, AUDIO_DECIMATED or AUDIO_OFF");
+		return false;
+	}
+	config->audio_mode = (audio_mode_t)args->audio;
+	if (args->gray != Py_None && !PyArg_ParseTuple(args->gray, "II", &config->gray_width, &config->gray_height)) {
+		return false;
+	}
+	if (config->gray_width > 256 || config->gray_height > 240) {
+		PyErr_SetString(PyExc_ValueError, "gray is at most (256, 240)");
+		return false;
+	}
+	if (!args->predicates) return true;
+
+	PyObject* sequence = PySequence_Fast(args->predicates, "predicates must be a sequence of (address, mask, comparison, value)");
+	if (!sequence) return false;
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+	bool ok = true;
+	if (count > CNES_ENV_MAX_PREDICATES) {
+		PyErr_Format(PyExc_ValueError, "at most %d predicates", CNES_ENV_MAX_PREDICATES);
+		ok = false;
+	}
+	for (Py_ssize_t i = 0; ok && i < count; i++) {
+		ok = parse_predicate(PySequence_Fast_GET_ITEM(sequence, i), &config->predicates[i]);
+	}
+	config->predicate_count = ok ? (size_t)count : 0;
+	Py_DECREF(sequence);
+	return ok;
+}
+
+/***** ENV *****/
+
+typedef struct {
+	PyObject_HEAD
+	cnes_env_t* env;
+	unsigned int generation;
+	unsigned int gray_width, gray_height;
+} env_object_t;
+
+static bool env_usable(env_object_t* self) {
+	if (!self->env || self->generation != rom_generation) {
+		PyErr_SetString(PyExc_RuntimeError, "a ROM was loaded after this environment was made");
+		return false;
+	}
+	return true;
+}
+
+static int env_init(env_object_t* self, PyObject* args, PyObject* kwargs) {
+	if (!rom) {
+		PyErr_SetString(PyExc_RuntimeError, "call cnes.load first");
+		return -1;
+	}
+	// Views of the environment it has may still be around
+	if (self->env) {
+		PyErr_SetString(PyExc_RuntimeError, "Env is already initialized");
+		return -1;
+	}
+	static char* keywords[] = { "sticky", "noop_max", "max_frames", "render", "gray", "audio", "predicates", NULL };
+	config_args_t values;
+	default_config_args(&values);
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$dIIpOiO:Env", keywords, &values.sticky, &values.noop_max,
+		&values.max_frames, &values.render, &values.gray, &values.audio, &values.predicates)) {
+		return -1;
+	}
+	cnes_env_config_t config;
+	if (!make_config(&values, &config)) return -1;
+
+	// Creating resets, which can run up to noop_max frames
+	cnes_env_t* env;
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	env = cnes_env_create(&config);
+	PyThread_release_lock(emulator_lock);
+	Py_END_ALLOW_THREADS
+	self->env = env;
+	if (!self->env) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	self->generation = rom_generation;
+	self->gray_width = config.render ? config.gray_width : 0;
+	self->gray_height = config.render ? config.gray_height : 0;
+	return 0;
+}
+
+static void env_dealloc(env_object_t* self) {
+	if (self->env) {
+		PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+		cnes_env_destroy(self->env);
+		PyThread_release_lock(emulator_lock);
+	}
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* env_reset(env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	if (!env_usable(self)) return NULL;
+	unsigned long long seed = 0;
+	if (nargs > 0) {
+		seed = PyLong_AsUnsignedLongLongMask(args[0]);
+		if (PyErr_Occurred()) return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	cnes_env_reset(self->env, seed);
+	PyThread_release_lock(emulator_lock);
+	Py_END_ALLOW_THREADS
+	Py_RETURN_NONE;
+}
+
+// step(buttons, frameskip=1) -> (done, truncated, frames)
+static PyObject* env_step(env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	if (!env_usable(self)) return NULL;
+	if (nargs < 1 || nargs > 2) {
+		PyErr_SetString(PyExc_TypeError, "step(buttons, frameskip=1)");
+		return NULL;
+	}
+	long buttons = PyLong_AsLong(args[0]);
+	long frameskip = nargs > 1 ? PyLong_AsLong(args[1]) : 1;
+	if (PyErr_Occurred()) return NULL;
+
+	cnes_env_result_t result;
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	result = cnes_env_step(self->env, (uint8_t)buttons, frameskip > 0 ? (uint32_t)frameskip : 0);
+	PyThread_release_lock(emulator_lock);
+	Py_END_ALLOW_THREADS
+
+	PyObject* tuple = PyTuple_New(3);
+	if (!tuple) return NULL;
+	PyTuple_SET_ITEM(tuple, 0, PyBool_FromLong(result.done));
+	PyTuple_SET_ITEM(tuple, 1, PyBool_FromLong(result.truncated));
+	PyTuple_SET_ITEM(tuple, 2, PyLong_FromUnsignedLong(result.frames));
+	return tuple;
+}
+
+static PyObject* env_get_ram(env_object_t* self, void* unused) {
+	if (!env_usable(self)) return NULL;
+	return make_view((PyObject*)self, cnes_env_ram(self->env), "B", 1, 2048, 1, 1);
+}
+
+static PyObject* env_get_cartridge_ram(env_object_t* self, void* unused) {
+	if (!env_usable(self)) return NULL;
+	size_t size;
+	const uint8_t* data = cnes_env_cartridge_ram(self->env, &size);
+	return make_view((PyObject*)self, data, "B", 1, (Py_ssize_t)size, 1, 1);
+}
+
+static PyObject* env_get_framebuffer(env_object_t* self, void* unused) {
+	if (!env_usable(self)) return NULL;
+	return make_view((PyObject*)self, cnes_env_framebuffer(self->env), "B", 1, 240, 256, 3);
+}
+
+static PyObject* env_get_gray(env_object_t* self, void* unused) {
+	if (!env_usable(self)) return NULL;
+	if (!self->gray_width || !self->gray_height) Py_RETURN_NONE;
+	return make_view((PyObject*)self, cnes_env_gray(self->env), "B", 1, self->gray_height, self->gray_width, 1);
+}
+
+static PyMethodDef env_methods[] = {
+	{ "reset", (PyCFunction)(void(*)(void))env_reset, METH_FASTCALL, "reset(seed=0)" },
+	{ "step", (PyCFunction)(void(*)(void))env_step, METH_FASTCALL, "step(buttons, frameskip=1) -> (done, truncated, frames)" },
+	{ NULL }
+};
+
+static PyGetSetDef env_getset[] = {
+	{ "ram", (getter)env_get_ram, NULL, "The 2 KB of CPU RAM", NULL },
+	{ "cartridge_ram", (getter)env_get_cartridge_ram, NULL, "PRG RAM at $6000, None without it", NULL },
+	{ "framebuffer", (getter)env_get_framebuffer, NULL, "240 x 256 x 3 RGB", NULL },
+	{ "gray", (getter)env_get_gray, NULL, "height x width grayscale, None unless gray was given", NULL },
+	{ NULL }
+};
+
+static PyTypeObject env_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "cnes.Env",
+	.tp_doc = PyDoc_STR("Env(*, sticky=0.25, noop_max=0, max_frames=0, render=True, gray=None, audio=AUDIO_OFF, predicates=())\n\n"
+		"The views are updated in place by every reset and step."),
+	.tp_basicsize = sizeof(env_object_t),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)env_init,
+	.tp_dealloc = (destructor)env_dealloc,
+	.tp_methods = env_methods,
+	.tp_getset = env_getset,
+};
+
+/***** VECENV *****/
+
+typedef struct {
+	PyObject_HEAD
+	cnes_vec_env_t* vec;
+	unsigned int generation;
+	size_t count;
+	size_t workers;
+	unsigned int gray_width, gray_height;
+	uint8_t* actions;
+	cnes_env_result_t* results;
+	uint8_t* done;
+	uint8_t* truncated;
+	uint32_t* frames;
+} vec_env_object_t;
+
+static bool vec_env_usable(vec_env_object_t* self) {
+	if (!self->vec || self->generation != rom_generation) {
+		PyErr_SetString(PyExc_RuntimeError, "a ROM was loaded after this environment was made");
+		return false;
+	}
+	return true;
+}
+
+static int vec_env_init(vec_env_object_t* self, PyObject* args, PyObject* kwargs) {
+	if (!rom) {
+		PyErr_SetString(PyExc_RuntimeError, "call cnes.load first");
+		return -1;
+	}
+	if (self->vec) {
+		PyErr_SetString(PyExc_RuntimeError, "VecEnv is already initialized");
+		return -1;
+	}
+	static char* keywords[] = { "count", "workers", "sticky", "noop_max", "max_frames", "render", "gray", "audio", "predicates", NULL };
+	Py_ssize_t count, workers = 0;
+	config_args_t values;
+	default_config_args(&values);
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|n$dIIpOiO:VecEnv", keywords, &count, &workers, &values.sticky,
+		&values.noop_max, &values.max_frames, &values.render, &values.gray, &values.audio, &values.predicates)) {
+		return -1;
+	}
+	cnes_env_config_t config;
+	if (!make_config(&values, &config)) return -1;
+	if (count <= 0 || workers < 0) {
+		PyErr_SetString(PyExc_ValueError, "count must be positive and workers not negative");
+		return -1;
+	}
+
+	self->count = (size_t)count;
+	self->workers = (size_t)workers;
+	self->actions = calloc(self->count, 1);
+	self->results = calloc(self->count, sizeof(cnes_env_result_t));
+	self->done = calloc(self->count, 1);
+	self->truncated = calloc(self->count, 1);
+	self->frames = calloc(self->count, sizeof(uint32_t));
+	if (!self->actions || !self->results || !self->done || !self->truncated || !self->frames) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	cnes_vec_env_t* vec;
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	vec = cnes_vec_env_create(&config, self->count, self->workers);
+	PyThread_release_lock(emulator_lock);
+	Py_END_ALLOW_THREADS
+	self->vec = vec;
+	if (!self->vec) {
+		PyErr_SetString(PyExc_OSError, "failed to start the environments");
+		return -1;
+	}
+	self->generation = rom_generation;
+	self->gray_width = config.render ? config.gray_width : 0;
+	self->gray_height = config.render ? config.gray_height : 0;
+	return 0;
+}
+
+static void vec_env_dealloc(vec_env_object_t* self) {
+	if (self->vec) {
+		PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+		cnes_vec_env_destroy(self->vec);
+		PyThread_release_lock(emulator_lock);
+	}
+	free(self->actions);
+	free(self->results);
+	free(self->done);
+	free(self->truncated);
+	free(self->frames);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* vec_env_reset(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	if (!vec_env_usable(self)) return NULL;
+	unsigned long long seed = 0;
+	if (nargs > 0) {
+		seed = PyLong_AsUnsignedLongLongMask(args[0]);
+		if (PyErr_Occurred()) return NULL;
+	}
+	bool ran;
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	ran = cnes_vec_env_reset(self->vec, seed);
+	PyThread_release_lock(emulator_lock);
+	Py_END_ALLOW_THREADS
+	if (!ran) {
+		PyErr_SetString(PyExc_RuntimeError, "a worker process died, the environments can't run any more");
+		return NULL;
+	}
+	memset(self->done, 0, self->count);
+	memset(self->truncated, 0, self->count);
+	memset(self->frames, 0, self->count * sizeof(uint32_t));
+	Py_RETURN_NONE;
+}
+
+// step(actions, frameskip=1), actions is count bytes. Results go to done, truncated and frames
+static PyObject* vec_env_step(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	if (!vec_env_usable(self)) return NULL;
+	if (nargs < 1 || nargs > 2) {
+		PyErr_SetString(PyExc_TypeError, "step(actions, frameskip=1)");
+		return NULL;
+	}
+	long frameskip = nargs > 1 ? PyLong_AsLong(args[1]) : 1;
+	if (PyErr_Occurred()) return NULL;
+
+	Py_buffer actions;
+	if (PyObject_GetBuffer(args[0], &actions, PyBUF_SIMPLE) != 0) return NULL;
+	if ((size_t)actions.len != self->count) {
+		PyBuffer_Release(&actions);
+		PyErr_Format(PyExc_ValueError, "expected %zu actions", self->count);
+		return NULL;
+	}
+	memcpy(self->actions, actions.buf, self->count);
+	PyBuffer_Release(&actions);
+
+	bool ran;
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	ran = cnes_vec_env_step(self->vec, self->actions, frameskip > 0 ? (uint32_t)frameskip : 0, self->results);
+	PyThread_release_lock(emulator_lock);
+	Py_END_ALLOW_THREADS
+	if (!ran) {
+		PyErr_SetString(PyExc_RuntimeError, "a worker process died, the environments can't run any more");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < self->count; i++) {
+		self->done[i] = self->results[i].done;
+		self->truncated[i] = self->results[i].truncated;
+		self->frames[i] = self->results[i].frames;
+	}
+	Py_RETURN_NONE;
+}
+
+static bool vec_env_index(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs, size_t* index) {
+	if (!vec_env_usable(self)) return false;
+	if (nargs != 1) {
+		PyErr_SetString(PyExc_TypeError, "expected the index of an environment");
+		return false;
+	}
+	Py_ssize_t i = PyLong_AsSsize_t(args[0]);
+	if (PyErr_Occurred()) return false;
+	if (i < 0 || (size_t)i >= self->count) {
+		PyErr_SetString(PyExc_IndexError, "environment index out of range");
+		return false;
+	}
+	*index = (size_t)i;
+	return true;
+}
+
+static PyObject* vec_env_ram(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	size_t i;
+	if (!vec_env_index(self, args, nargs, &i)) return NULL;
+	return make_view((PyObject*)self, cnes_vec_env_ram(self->vec, i), "B", 1, 2048, 1, 1);
+}
+
+static PyObject* vec_env_cartridge_ram(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	size_t i;
+	if (!vec_env_index(self, args, nargs, &i)) return NULL;
+	size_t size;
+	const uint8_t* data = cnes_vec_env_cartridge_ram(self->vec, i, &size);
+	return make_view((PyObject*)self, data, "B", 1, (Py_ssize_t)size, 1, 1);
+}
+
+static PyObject* vec_env_framebuffer(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	size_t i;
+	if (!vec_env_index(self, args, nargs, &i)) return NULL;
+	return make_view((PyObject*)self, cnes_vec_env_framebuffer(self->vec, i), "B", 1, 240, 256, 3);
+}
+
+static PyObject* vec_env_gray(vec_env_object_t* self, PyObject* const* args, Py_ssize_t nargs) {
+	size_t i;
+	if (!vec_env_index(self, args, nargs, &i)) return NULL;
+	if (!self->gray_width || !self->gray_height) Py_RETURN_NONE;
+	return make_view((PyObject*)self, cnes_vec_env_gray(self->vec, i), "B", 1, self->gray_height, self->gray_width, 1);
+}
+
+static PyObject* vec_env_get_done(vec_env_object_t* self, void* unused) {
+	return make_view((PyObject*)self, self->done, "?", 1, (Py_ssize_t)self->count, 1, 1);
+}
+
+static PyObject* vec_env_get_truncated(vec_env_object_t* self, void* unused) {
+	return make_view((PyObject*)self, self->truncated, "?", 1, (Py_ssize_t)self->count, 1, 1);
+}
+
+static PyObject* vec_env_get_frames(vec_env_object_t* self, void* unused) {
+	return make_view((PyObject*)self, self->frames, "I", sizeof(uint32_t), (Py_ssize_t)self->count, 1, 1);
+}
+
+static PyMethodDef vec_env_methods[] = {
+	{ "reset", (PyCFunction)(void(*)(void))vec_env_reset, METH_FASTCALL, "reset(seed=0), environment i gets seed + i" },
+	{ "step", (PyCFunction)(void(*)(void))vec_env_step, METH_FASTCALL, "step(actions, frameskip=1), results are in done, truncated and frames" },
+	{ "ram", (PyCFunction)(void(*)(void))vec_env_ram, METH_FASTCALL, "ram(i)" },
+	{ "cartridge_ram", (PyCFunction)(void(*)(void))vec_env_cartridge_ram, METH_FASTCALL, "cartridge_ram(i)" },
+	{ "framebuffer", (PyCFunction)(void(*)(void))vec_env_framebuffer, METH_FASTCALL, "framebuffer(i)" },
+	{ "gray", (PyCFunction)(void(*)(void))vec_env_gray, METH_FASTCALL, "gray(i)" },
+	{ NULL }
+};
+
+static PyGetSetDef vec_env_getset[] = {
+	{ "done", (getter)vec_env_get_done, NULL, "Per environment, from the last step", NULL },
+	{ "truncated", (getter)vec_env_get_truncated, NULL, "Per environment, from the last step", NULL },
+	{ "frames", (getter)vec_env_get_frames, NULL, "Frames each environment ran in the last step", NULL },
+	{ NULL }
+};
+
+static PyTypeObject vec_env_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "cnes.VecEnv",
+	.tp_doc = PyDoc_STR("VecEnv(count, workers=0, *, sticky=0.25, noop_max=0, max_frames=0, render=True, gray=None, audio=AUDIO_OFF, predicates=())\n\n"
+		"Steps count environments in one call, split over worker processes. The views are\n"
+		"updated in place by every step."),
+	.tp_basicsize = sizeof(vec_env_object_t),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)vec_env_init,
+	.tp_dealloc = (destructor)vec_env_dealloc,
+	.tp_methods = vec_env_methods,
+	.tp_getset = vec_env_getset,
+};
+
+/***** MODULE *****/
+
+static PyObject* cnes_load(PyObject* module, PyObject* arg) {
+	Py_buffer data;
+	if (PyObject_GetBuffer(arg, &data, PyBUF_SIMPLE) != 0) return NULL;
+	int check = cnes_check_ines(data.buf, (size_t)data.len);
+	if (check != CNES_LOAD_NO_ERR) {
+		// The loaded ROM and its environments go on as they were
+		PyBuffer_Release(&data);
+		PyErr_SetString(PyExc_ValueError, check == CNES_LOAD_NOT_INES ? "not an iNES file" : "mapper not supported");
+		return NULL;
+	}
+	char* copy = malloc((size_t)data.len + 1);
+	if (!copy) {
+		PyBuffer_Release(&data);
+		return PyErr_NoMemory();
+	}
+	memcpy(copy, data.buf, (size_t)data.len);
+	size_t size = (size_t)data.len;
+	PyBuffer_Release(&data);
+
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	bool loaded = cnes_env_load(copy, size);
+	// The emulator has left the previous ROM even when cnes_env_load ran out of memory,
+	// the environments made from it only raise from now on
+	free(rom);
+	rom = copy;
+	rom_generation++;
+	PyThread_release_lock(emulator_lock);
+	if (!loaded) return PyErr_NoMemory();
+	Py_RETURN_NONE;
+}
+
+static PyObject* cnes_set_audio_rate(PyObject* module, PyObject* args) {
+	unsigned int rate;
+	if (!PyArg_ParseTuple(args, "I:set_audio_rate", &rate)) return NULL;
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	audio_sample_rate = rate;
+	PyThread_release_lock(emulator_lock);
+	Py_RETURN_NONE;
+}
+
+static PyObject* cnes_audio_ring_view(PyObject* module, PyObject* unused) {
+	size_t read, write;
+	// An Env stepping in another thread moves write
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	const int16_t* ring = cnes_audio_ring(&read, &write);
+	PyThread_release_lock(emulator_lock);
+	PyObject* view = make_view(NULL, ring, "h", sizeof(int16_t), CNES_AUDIO_RING_SIZE, 1, 1);
+	if (!view) return NULL;
+	return Py_BuildValue("(Nnn)", view, (Py_ssize_t)read, (Py_ssize_t)write);
+}
+
+static PyObject* cnes_audio_skip_samples(PyObject* module, PyObject* arg) {
+	Py_ssize_t count = PyLong_AsSsize_t(arg);
+	if (PyErr_Occurred()) return NULL;
+	PyThread_acquire_lock(emulator_lock, WAIT_LOCK);
+	cnes_audio_skip(count > 0 ? (size_t)count : 0);
+	PyThread_release_lock(emulator_lock);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef cnes_methods[] = {
+	{ "load", cnes_load, METH_O, "load(rom), every Env and VecEnv plays the last ROM loaded" },
+	{ "set_audio_rate", cnes_set_audio_rate, METH_VARARGS,
+		"set_audio_rate(rate), the mode is the audio argument of each Env" },
+	{ "audio_ring", cnes_audio_ring_view, METH_NOARGS,
+		"audio_ring() -> (ring, read, write), samples read .. write - 1 are at ring[position % len(ring)]" },
+	{ "audio_skip", cnes_audio_skip_samples, METH_O, "audio_skip(count), marks samples as read" },
+	{ NULL }
+};
+
+static struct PyModuleDef cnes_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "cnes",
+	.m_doc = PyDoc_STR("NES emulation for reinforcement learning"),
+	.m_size = -1,
+	.m_methods = cnes_methods,
+};
+
+PyMODINIT_FUNC PyInit_cnes(void) {
+	if (PyType_Ready(&view_type) < 0 || PyType_Ready(&env_type) < 0 || PyType_Ready(&vec_env_type) < 0) {
+		return NULL;
+	}
+	if (!emulator_lock) {
+		emulator_lock = PyThread_allocate_lock();
+		if (!emulator_lock) return PyErr_NoMemory();
+	}
+
+	PyObject* module = PyModule_Create(&cnes_module);
+	if (!module) return NULL;
+	if (PyModule_AddObjectRef(module, "Env", (PyObject*)&env_type) < 0 ||
+		PyModule_AddObjectRef(module, "VecEnv", (PyObject*)&vec_env_type) < 0 ||
+		PyModule_AddIntConstant(module, "AUDIO_FULL", AUDIO_FULL) < 0 ||
+		PyModule_AddIntConstant(module, "AUDIO_DECIMATED", AUDIO_DECIMATED) < 0 ||
+		PyModule_AddIntConstant(module, "AUDIO_OFF", AUDIO_OFF) < 0) {
+		Py_DECREF(module);
+		return NULL;
+	}
+	return module;
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include "env.h"
+
+struct cnes_env {
+	cnes_env_config_t config;
+	uint64_t random;
+	uint8_t held;            // Buttons down in the last frame, what a sticky action repeats
+	uint32_t episode_frame;
+	bool done;
+	// The cnes_env_load it was made after, its state has that ROM's size
+	unsigned int load;
+
+	// Where the environment is kept while another one runs
+	uint8_t* state;
+	// What the views show, copied out after every reset and step
+	uint8_t ram[2048];
+	uint8_t cartridge_ram[0x2000];
+	pixformat_t* framebuffer;
+	uint8_t gray[256 * 240];
+};
+
+static uint8_t* start_state = NULL;
+static size_t state_size = 0;
+static unsigned int load_count = 0;
+
+// The environment whose state is in the emulator
+static cnes_env_t* active_env = NULL;
+
+bool cnes_env_load(const char* rom, size_t size) {
+	if (cnes_check_ines(rom, size) != CNES_LOAD_NO_ERR || load_ines(rom) != CNES_LOAD_NO_ERR) return false;
+	active_env = NULL;
+	load_count++;
+
+	state_size = cnes_state_size();
+	free(start_state);
+	start_state = malloc(state_size);
+	if (!start_state) return false;
+	cnes_save_state_to(start_state);
+	return true;
+}
+
+cnes_env_config_t cnes_env_default_config() {
+	cnes_env_config_t config = { 0 };
+	config.sticky_probability = 0.25f;
+	config.render = true;
+	config.audio_mode = AUDIO_OFF;
+	return config;
+}
+
+cnes_env_t* cnes_env_create(const cnes_env_config_t* config) {
+	if (!start_state) return NULL;
+
+	cnes_env_t* env = calloc(1, sizeof(cnes_env_t));
+	if (!env) return NULL;
+	env->config = *config;
+	env->load = load_count;
+	if (env->config.predicate_count > CNES_ENV_MAX_PREDICATES) {
+		env->config.predicate_count = CNES_ENV_MAX_PREDICATES;
+	}
+	// A probability, NaN counts as never
+	if (!(env->config.sticky_probability >= 0)) env->config.sticky_probability = 0;
+	if (env->config.sticky_probability > 1) env->config.sticky_probability = 1;
+	// Like tick_frame does
+	if (env->config.gray_width > 256) env->config.gray_width = 256;
+	if (env->config.gray_height > 240) env->config.gray_height = 240;
+	env->state = malloc(state_size);
+	env->framebuffer = calloc(256 * 240, sizeof(pixformat_t));
+	if (!env->state || !env->framebuffer) {
+		cnes_env_destroy(env);
+		return NULL;
+	}
+	cnes_env_reset(env, 0);
+	return env;
+}
+
+void cnes_env_destroy(cnes_env_t* env) {
+	if (!env) return;
+	if (active_env == env) active_env = NULL;
+	free(env->state);
+	free(env->framebuffer);
+	free(env);
+}
+
+static bool draws_gray(const cnes_env_t* env) {
+	return env->config.render && env->config.gray_width && env->config.gray_height;
+}
+
+// Copies what the emulator shows for env into the storage its views point at. The
+// picture only when env drew frames, otherwise it may be another environment's
+static void publish(cnes_env_t* env, bool drawn) {
+	memcpy(env->ram, cpuram, sizeof(env->ram));
+	if (cartridge_ram) {
+		memcpy(env->cartridge_ram, cartridge_ram, cartridge_ram_size);
+	}
+	if (!drawn) return;
+	if (draws_gray(env)) {
+		memcpy(env->gray, framebuffer_gray, (size_t)env->config.gray_width * env->config.gray_height);
+	} else if (env->config.render) {
+		memcpy(env->framebuffer, framebuffer, sizeof(framebuffer));
+	}
+}
+
+// Makes env the one in the emulator, with the state it was left in
+static void activate(cnes_env_t* env) {
+	if (active_env == env) return;
+	if (active_env) cnes_save_state_to(active_env->state);
+	cnes_load_state_from(env->state);
+	active_env = env;
+}
+
+// splitmix64, good enough to spread a seed and to draw sticky actions
+static uint64_t next_random(cnes_env_t* env) {
+	uint64_t z = (env->random += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static bool predicate_true(const cnes_env_predicate_t* predicate) {
+	uint8_t value = cpuram[predicate->address & 0x7FF] & predicate->mask;
+	switch (predicate->compare) {
+	case CNES_ENV_EQUAL: return value == predicate->value;
+	case CNES_ENV_NOT_EQUAL: return value != predicate->value;
+	case CNES_ENV_LESS: return value < predicate->value;
+	case CNES_ENV_GREATER: return value > predicate->value;
+	}
+	return false;
+}
+
+static bool episode_over(cnes_env_t* env) {
+	for (size_t i = 0; i < env->config.predicate_count; i++) {
+		if (predicate_true(&env->config.predicates[i])) return true;
+	}
+	return false;
+}
+
+static void run_frame(cnes_env_t* env, uint8_t buttons) {
+	buttons_down[0] = buttons;
+	buttons_down[1] = 0;
+	video_output_enabled = env->config.render;
+	gray_width = env->config.gray_width;
+	gray_height = env->config.gray_height;
+	audio_mode = env->config.audio_mode;
+	tick_frame();
+	env->held = buttons;
+}
+
+void cnes_env_reset(cnes_env_t* env, uint64_t seed) {
+	if (env->load != load_count) return;
+	if (active_env && active_env != env) cnes_save_state_to(active_env->state);
+	cnes_load_state_from(start_state);
+	active_env = env;
+
+	env->random = seed;
+	env->held = 0;
+	env->episode_frame = 0;
+	env->done = false;
+	memset(env->framebuffer, 0, 256 * 240 * sizeof(pixformat_t));
+	memset(env->gray, 0, sizeof(env->gray));
+
+	uint32_t noops = env->config.max_noop_frames ? (uint32_t)(next_random(env) % (env->config.max_noop_frames + 1)) : 0;
+	for (uint32_t i = 0; i < noops; i++) {
+		run_frame(env, 0);
+	}
+	publish(env, noops > 0);
+}
+
+cnes_env_result_t cnes_env_step(cnes_env_t* env, uint8_t buttons, uint32_t frameskip) {
+	cnes_env_result_t result = { 0 };
+	if (env->load != load_count) {
+		result.done = true;
+		return result;
+	}
+	activate(env);
+
+	// 53 bits of the draw against the probability, like a double would
+	uint64_t sticky = (uint64_t)(env->config.sticky_probability * (double)(1ULL << 53));
+	while (result.frames < frameskip && !env->done) {
+		bool keep = sticky && (next_random(env) >> 11) < sticky;
+		run_frame(env, keep ? env->held : buttons);
+		result.frames++;
+		env->episode_frame++;
+
+		if (episode_over(env)) {
+			env->done = true;
+		} else if (env->config.max_episode_frames && env->episode_frame >= env->config.max_episode_frames) {
+			env->done = true;
+			result.truncated = true;
+		}
+	}
+
+	publish(env, result.frames > 0);
+	result.done = env->done;
+	result.episode_frame = env->episode_frame;
+	return result;
+}
+
+const uint8_t* cnes_env_ram(cnes_env_t* env) {
+	return env->ram;
+}
+
+const pixformat_t* cnes_env_framebuffer(cnes_env_t* env) {
+	return env->framebuffer;
+}
+
+const uint8_t* cnes_env_gray(cnes_env_t* env) {
+	return env->gray;
+}
+
+const uint8_t* cnes_env_cartridge_ram(cnes_env_t* env, size_t* size) {
+	*size = cartridge_ram ? cartridge_ram_size : 0;
+	return cartridge_ram ? env->cartridge_ram : NULL;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <cnes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef enum {
+		CNES_ENV_EQUAL,
+		CNES_ENV_NOT_EQUAL,
+		CNES_ENV_LESS,
+		CNES_ENV_GREATER
+	} cnes_env_compare_t;
+
+	// The episode ends when (cpuram[address] & mask) compares true against value
+	typedef struct {
+		uint16_t address;
+		uint8_t mask;
+		cnes_env_compare_t compare;
+		uint8_t value;
+	} cnes_env_predicate_t;
+
+	#define CNES_ENV_MAX_PREDICATES 8
+
+	typedef struct {
+		// Chance that the buttons of the previous frame are kept instead of the new action,
+		// drawn every frame
+		float sticky_probability;
+		// Frames of no input after reset, a random number up to this many drawn from the seed
+		uint32_t max_noop_frames;
+		// The episode is cut off after this many frames, 0 for never
+		uint32_t max_episode_frames;
+		// Fill framebuffer, leave it off when the agent only looks at RAM
+		bool render;
+		// Draw a grayscale image of this size instead of framebuffer when rendering,
+		// see gray_width in cnes.h
+		unsigned int gray_width;
+		unsigned int gray_height;
+		// What the APU makes while this environment runs, off unless the agent listens
+		audio_mode_t audio_mode;
+		size_t predicate_count;
+		cnes_env_predicate_t predicates[CNES_ENV_MAX_PREDICATES];
+	} cnes_env_config_t;
+
+	typedef struct {
+		bool done;
+		bool truncated;          // Done because of max_episode_frames
+		uint32_t frames;         // Frames run by this step, fewer than frameskip when the episode ended
+		uint32_t episode_frame;  // Frames since reset
+	} cnes_env_result_t;
+
+	typedef struct cnes_env cnes_env_t;
+
+	cnes_env_config_t cnes_env_default_config();
+
+	// Loads the ROM, which must stay valid as long as any environment exists. Every
+	// environment in the process plays the same ROM. False when the size bytes at rom aren't
+	// an iNES file cnes can play, nothing changes then, or when there is no memory for the
+	// start state. Environments made before a later load are stale, their state doesn't fit
+	// the new ROM: reset does nothing and step returns done without running. Destroy them
+	bool cnes_env_load(const char* rom, size_t size);
+
+	// Environments share the one emulator in turn, each keeps its own state while another
+	// one runs. The state they start from is the one at cnes_env_load
+	cnes_env_t* cnes_env_create(const cnes_env_config_t* config);
+	void cnes_env_destroy(cnes_env_t* env);
+
+	void cnes_env_reset(cnes_env_t* env, uint64_t seed);
+	// Runs frameskip frames holding the buttons of player 1, stopping early at the end of the
+	// episode. Once it is done, nothing runs until the next reset
+	cnes_env_result_t cnes_env_step(cnes_env_t* env, uint8_t buttons, uint32_t frameskip);
+
+	// The environment's 2 KB of CPU RAM and its framebuffer as of its last reset or step.
+	// Each environment has its own copy, the pointers stay valid until it is destroyed
+	const uint8_t* cnes_env_ram(cnes_env_t* env);
+	const pixformat_t* cnes_env_framebuffer(cnes_env_t* env);
+	// gray_width x gray_height bytes
+	const uint8_t* cnes_env_gray(cnes_env_t* env);
+	// PRG RAM at $6000, NULL with size 0 when the cartridge has none
+	const uint8_t* cnes_env_cartridge_ram(cnes_env_t* env, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
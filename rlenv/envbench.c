@@ -0,0 +1,94 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "env.h"
+#include "vecenv.h"
+
+// Steps a batch of environments with random actions and reports environment steps per
+// second, the number to compare against when the agent's glue is the slow part.
+
+static double now() {
+	struct timespec t;
+	timespec_get(&t, TIME_UTC);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: envbench <rom.nes> [envs] [workers] [frameskip] [steps] [render] [gray size]\n");
+		fprintf(stderr, "  defaults to 8 environments, 0 workers, 4 frames per step, 1000 steps, render 1 and RGB\n");
+		return 1;
+	}
+
+	size_t rom_size = 0;
+	char* rom = cnes_read_file(argv[1], &rom_size);
+	if (!rom) {
+		fprintf(stderr, "Failed to read %s\n", argv[1]);
+		return 1;
+	}
+	size_t count = argc > 2 ? (size_t)atol(argv[2]) : 8;
+	size_t workers = argc > 3 ? (size_t)atol(argv[3]) : 0;
+	uint32_t frameskip = argc > 4 ? (uint32_t)atol(argv[4]) : 4;
+	uint32_t steps = argc > 5 ? (uint32_t)atol(argv[5]) : 1000;
+	bool render = argc > 6 ? atoi(argv[6]) != 0 : true;
+	unsigned int gray = argc > 7 ? (unsigned int)atoi(argv[7]) : 0;
+
+	if (count == 0 || !cnes_env_load(rom, rom_size)) {
+		fprintf(stderr, "Not an iNES file or mapper not supported!\n");
+		return 1;
+	}
+
+	cnes_env_config_t config = cnes_env_default_config();
+	config.render = render;
+	config.gray_width = config.gray_height = gray;
+	// Random play rarely ends an episode, so cut them off after a minute
+	config.max_episode_frames = 3600;
+
+	cnes_vec_env_t* vec = cnes_vec_env_create(&config, count, workers);
+	uint8_t* actions = malloc(count);
+	cnes_env_result_t* results = malloc(count * sizeof(cnes_env_result_t));
+	if (!vec || !actions || !results) {
+		fprintf(stderr, "Failed to start the environments\n");
+		return 1;
+	}
+
+	uint32_t random = 1;
+	uint64_t frames = 0;
+	uint32_t episodes = 0;
+	double start = now();
+	for (uint32_t step = 0; step < steps; step++) {
+		for (size_t i = 0; i < count; i++) {
+			random = random * 1103515245 + 12345;
+			actions[i] = (uint8_t)(random >> 16);
+		}
+		if (!cnes_vec_env_step(vec, actions, frameskip, results)) {
+			fprintf(stderr, "A worker process died\n");
+			return 1;
+		}
+		for (size_t i = 0; i < count; i++) {
+			frames += results[i].frames;
+			episodes += results[i].done;
+		}
+	}
+	double seconds = now() - start;
+
+	uint64_t total_steps = (uint64_t)steps * count;
+	printf("%zu environments, %zu workers, frameskip %u, render %s", count, workers, frameskip, render ? "on" : "off");
+	if (render && gray) {
+		printf(" in %ux%u gray", gray, gray);
+	}
+	printf("\n");
+	printf("%llu steps, %llu frames, %u episodes ended in %.2fs\n",
+		(unsigned long long)total_steps, (unsigned long long)frames, episodes, seconds);
+	printf("%.0f steps per second, %.0f frames per second\n",
+		seconds > 0 ? total_steps / seconds : 0.0, seconds > 0 ? frames / seconds : 0.0);
+
+	cnes_vec_env_destroy(vec);
+	free(actions);
+	free(results);
+	free(rom);
+	return 0;
+}
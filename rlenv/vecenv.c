@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vecenv.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VEC_ENV_FORK
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+// A worker that is gone must not take the host down with SIGPIPE
+#if defined(VEC_ENV_FORK) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+#define COMMAND_STEP  1
+#define COMMAND_RESET 2
+#define COMMAND_QUIT  3
+
+typedef struct {
+	uint8_t command;
+	uint32_t frameskip;
+	uint64_t seed;
+} command_t;
+
+// What the parent and a worker share about one environment
+typedef struct {
+	uint8_t action;
+	uint64_t episode;
+	cnes_env_result_t result;
+	uint8_t ram[2048];
+	uint8_t cartridge_ram[0x2000];
+	pixformat_t framebuffer[256 * 240];
+	uint8_t gray[256 * 240];
+} slot_t;
+
+typedef struct {
+	int pid;
+	int socket;  // Commands go one way, the answer once they are done the other
+} worker_t;
+
+struct cnes_vec_env {
+	cnes_env_config_t config;
+	size_t count;
+	uint64_t seed;
+
+	// Without workers, the environments live in this process
+	cnes_env_t** envs;
+
+	size_t worker_count;
+	worker_t* workers;
+	slot_t* slots;
+	// A worker stopped answering, nothing runs any more
+	bool failed;
+};
+
+// Environments first .. last - 1 go to worker w
+static size_t first_env(const cnes_vec_env_t* vec, size_t w) {
+	return vec->count * w / vec->worker_count;
+}
+
+static void reset_env(cnes_vec_env_t* vec, cnes_env_t* env, size_t i, uint64_t episode) {
+	cnes_env_reset(env, vec->seed + i + vec->count * episode);
+}
+
+static void step_env(cnes_vec_env_t* vec, cnes_env_t* env, size_t i, slot_t* slot, uint32_t frameskip) {
+	if (slot->result.done) {
+		slot->episode++;
+		reset_env(vec, env, i, slot->episode);
+	}
+	slot->result = cnes_env_step(env, slot->action, frameskip);
+}
+
+#ifdef VEC_ENV_FORK
+static void publish(cnes_vec_env_t* vec, cnes_env_t* env, slot_t* slot) {
+	memcpy(slot->ram, cnes_env_ram(env), sizeof(slot->ram));
+	size_t size;
+	const uint8_t* cartridge = cnes_env_cartridge_ram(env, &size);
+	if (cartridge) {
+		memcpy(slot->cartridge_ram, cartridge, size);
+	}
+	if (vec->config.render && vec->config.gray_width && vec->config.gray_height) {
+		memcpy(slot->gray, cnes_env_gray(env), sizeof(slot->gray));
+	} else if (vec->config.render) {
+		memcpy(slot->framebuffer, cnes_env_framebuffer(env), sizeof(slot->framebuffer));
+	}
+}
+
+// Both go on through signals, a Python host gets them while the workers run
+static bool send_all(int socket, const void* data, size_t size) {
+	const uint8_t* at = data;
+	while (size > 0) {
+		ssize_t sent = send(socket, at, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return false;
+		at += sent;
+		size -= (size_t)sent;
+	}
+	return true;
+}
+
+static bool receive_all(int socket, void* data, size_t size) {
+	uint8_t* at = data;
+	while (size > 0) {
+		ssize_t received = recv(socket, at, size, 0);
+		if (received < 0 && errno == EINTR) continue;
+		if (received <= 0) return false;
+		at += received;
+		size -= (size_t)received;
+	}
+	return true;
+}
+
+static void worker_main(cnes_vec_env_t* vec, size_t w) {
+	int socket = vec->workers[w].socket;
+	size_t first = first_env(vec, w);
+	size_t last = first_env(vec, w + 1);
+	cnes_env_t** envs = calloc(last - first, sizeof(cnes_env_t*));
+	uint8_t ready = envs != NULL;
+	for (size_t i = first; i < last && ready; i++) {
+		envs[i - first] = cnes_env_create(&vec->config);
+		ready = envs[i - first] != NULL;
+	}
+	if (!send_all(socket, &ready, 1) || !ready) _exit(1);
+
+	command_t command;
+	while (receive_all(socket, &command, sizeof(command)) && command.command != COMMAND_QUIT) {
+		for (size_t i = first; i < last; i++) {
+			slot_t* slot = &vec->slots[i];
+			if (command.command == COMMAND_RESET) {
+				vec->seed = command.seed;
+				memset(&slot->result, 0, sizeof(slot->result));
+				slot->episode = 0;
+				reset_env(vec, envs[i - first], i, 0);
+			} else {
+				step_env(vec, envs[i - first], i, slot, command.frameskip);
+			}
+			publish(vec, envs[i - first], slot);
+		}
+		uint8_t done = 1;
+		if (!send_all(socket, &done, 1)) break;
+	}
+	_exit(0);
+}
+
+static bool start_workers(cnes_vec_env_t* vec) {
+	for (size_t w = 0; w < vec->worker_count; w++) {
+		vec->workers[w].socket = -1;
+	}
+	for (size_t w = 0; w < vec->worker_count; w++) {
+		int sockets[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return false;
+#ifdef SO_NOSIGPIPE
+		int on = 1;
+		setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+		setsockopt(sockets[1], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+		int pid = fork();
+		if (pid < 0) {
+			close(sockets[0]);
+			close(sockets[1]);
+			return false;
+		}
+		if (pid == 0) {
+			close(sockets[0]);
+			// Only the parent should keep the other workers' sockets open
+			for (size_t other = 0; other < w; other++) {
+				close(vec->workers[other].socket);
+			}
+			vec->workers[w].socket = sockets[1];
+			worker_main(vec, w);
+		}
+		close(sockets[1]);
+		vec->workers[w].pid = pid;
+		vec->workers[w].socket = sockets[0];
+	}
+
+	// Each one says whether it could make its environments
+	bool ready = true;
+	for (size_t w = 0; w < vec->worker_count; w++) {
+		uint8_t created = 0;
+		ready = receive_all(vec->workers[w].socket, &created, 1) && created && ready;
+	}
+	return ready;
+}
+
+static bool run_workers(cnes_vec_env_t* vec, const command_t* command) {
+	for (size_t w = 0; w < vec->worker_count; w++) {
+		if (!send_all(vec->workers[w].socket, command, sizeof(*command))) vec->failed = true;
+	}
+	for (size_t w = 0; w < vec->worker_count; w++) {
+		uint8_t done;
+		if (!receive_all(vec->workers[w].socket, &done, 1)) vec->failed = true;
+	}
+	return !vec->failed;
+}
+#endif
+
+cnes_vec_env_t* cnes_vec_env_create(const cnes_env_config_t* config, size_t count, size_t workers) {
+	if (count == 0) return NULL;
+	cnes_vec_env_t* vec = calloc(1, sizeof(cnes_vec_env_t));
+	if (!vec) return NULL;
+	vec->config = *config;
+	vec->count = count;
+
+#ifdef VEC_ENV_FORK
+	vec->worker_count = workers < count ? workers : count;
+#endif
+	if (vec->worker_count == 0) {
+		vec->envs = calloc(count, sizeof(cnes_env_t*));
+		vec->slots = calloc(count, sizeof(slot_t));
+		if (!vec->envs || !vec->slots) {
+			cnes_vec_env_destroy(vec);
+			return NULL;
+		}
+		for (size_t i = 0; i < count; i++) {
+			vec->envs[i] = cnes_env_create(config);
+			if (!vec->envs[i]) {
+				cnes_vec_env_destroy(vec);
+				return NULL;
+			}
+		}
+	}
+#ifdef VEC_ENV_FORK
+	else {
+		vec->workers = calloc(vec->worker_count, sizeof(worker_t));
+		vec->slots = mmap(NULL, count * sizeof(slot_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (vec->slots == MAP_FAILED) vec->slots = NULL;
+		if (!vec->workers || !vec->slots || !start_workers(vec)) {
+			cnes_vec_env_destroy(vec);
+			return NULL;
+		}
+	}
+#endif
+	if (!cnes_vec_env_reset(vec, 0)) {
+		cnes_vec_env_destroy(vec);
+		return NULL;
+	}
+	return vec;
+}
+
+void cnes_vec_env_destroy(cnes_vec_env_t* vec) {
+	if (!vec) return;
+	if (vec->envs) {
+		for (size_t i = 0; i < vec->count; i++) {
+			cnes_env_destroy(vec->envs[i]);
+		}
+		free(vec->envs);
+		free(vec->slots);
+	}
+#ifdef VEC_ENV_FORK
+	if (vec->workers) {
+		command_t quit = { COMMAND_QUIT, 0, 0 };
+		for (size_t w = 0; w < vec->worker_count; w++) {
+			if (vec->workers[w].pid <= 0) continue;
+			// One that is gone already fails this, waitpid still reaps it
+			send_all(vec->workers[w].socket, &quit, sizeof(quit));
+			close(vec->workers[w].socket);
+			waitpid(vec->workers[w].pid, NULL, 0);
+		}
+		free(vec->workers);
+		if (vec->slots) munmap(vec->slots, vec->count * sizeof(slot_t));
+	}
+#endif
+	free(vec);
+}
+
+bool cnes_vec_env_reset(cnes_vec_env_t* vec, uint64_t seed) {
+	if (vec->failed) return false;
+	vec->seed = seed;
+#ifdef VEC_ENV_FORK
+	if (vec->worker_count > 0) {
+		command_t command = { COMMAND_RESET, 0, seed };
+		return run_workers(vec, &command);
+	}
+#endif
+	for (size_t i = 0; i < vec->count; i++) {
+		memset(&vec->slots[i].result, 0, sizeof(vec->slots[i].result));
+		vec->slots[i].episode = 0;
+		reset_env(vec, vec->envs[i], i, 0);
+	}
+	return true;
+}
+
+bool cnes_vec_env_step(cnes_vec_env_t* vec, const uint8_t* actions, uint32_t frameskip, cnes_env_result_t* results) {
+	if (vec->failed) return false;
+	for (size_t i = 0; i < vec->count; i++) {
+		vec->slots[i].action = actions[i];
+	}
+#ifdef VEC_ENV_FORK
+	if (vec->worker_count > 0) {
+		command_t command = { COMMAND_STEP, frameskip, 0 };
+		if (!run_workers(vec, &command)) return false;
+	} else
+#endif
+	{
+		for (size_t i = 0; i < vec->count; i++) {
+			step_env(vec, vec->envs[i], i, &vec->slots[i], frameskip);
+		}
+	}
+	for (size_t i = 0; i < vec->count; i++) {
+		results[i] = vec->slots[i].result;
+	}
+	return true;
+}
+
+const uint8_t* cnes_vec_env_ram(cnes_vec_env_t* vec, size_t i) {
+	return vec->envs ? cnes_env_ram(vec->envs[i]) : vec->slots[i].ram;
+}
+
+const pixformat_t* cnes_vec_env_framebuffer(cnes_vec_env_t* vec, size_t i) {
+	return vec->envs ? cnes_env_framebuffer(vec->envs[i]) : vec->slots[i].framebuffer;
+}
+
+const uint8_t* cnes_vec_env_gray(cnes_vec_env_t* vec, size_t i) {
+	return vec->envs ? cnes_env_gray(vec->envs[i]) : vec->slots[i].gray;
+}
+
+const uint8_t* cnes_vec_env_cartridge_ram(cnes_vec_env_t* vec, size_t i, size_t* size) {
+	*size = cartridge_ram ? cartridge_ram_size : 0;
+	if (!cartridge_ram) return NULL;
+	return vec->envs ? cnes_env_cartridge_ram(vec->envs[i], size) : vec->slots[i].cartridge_ram;
+}
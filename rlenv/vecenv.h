@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "env.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef struct cnes_vec_env cnes_vec_env_t;
+
+	// count environments split over worker processes, which step them in parallel. The
+	// emulator is one per process, so that is what parallel takes. With no workers, or
+	// where there is no fork, they all run in turn in this process. Workers are forked
+	// from it: call after cnes_env_load and before any frame is drawn with video_threads.
+	// NULL when the environments can't be made, in this process or in a worker
+	cnes_vec_env_t* cnes_vec_env_create(const cnes_env_config_t* config, size_t count, size_t workers);
+	void cnes_vec_env_destroy(cnes_vec_env_t* vec);
+
+	// Environment i is reset with seed + i
+	bool cnes_vec_env_reset(cnes_vec_env_t* vec, uint64_t seed);
+	// Steps environment i with actions[i] and fills results[i]. One that was done at the
+	// end of the last step is reset first, with its next seed seed + i + count * episode.
+	// Reset and step return false once a worker has died: the environments can then only
+	// be destroyed
+	bool cnes_vec_env_step(cnes_vec_env_t* vec, const uint8_t* actions, uint32_t frameskip, cnes_env_result_t* results);
+
+	// Views of environment i, valid until the next step or reset
+	const uint8_t* cnes_vec_env_ram(cnes_vec_env_t* vec, size_t i);
+	const pixformat_t* cnes_vec_env_framebuffer(cnes_vec_env_t* vec, size_t i);
+	const uint8_t* cnes_vec_env_gray(cnes_vec_env_t* vec, size_t i);
+	const uint8_t* cnes_vec_env_cartridge_ram(cnes_vec_env_t* vec, size_t i, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
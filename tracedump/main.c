@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <cnes.h>
+
+// Records an execution trace of a ROM to a file, and prints one back as text with
+// every instruction disassembled, a line per instruction in the layout of the usual
+// nestest logs so two traces can be diffed to find where they part.
+
+static void file_write(const void* data, size_t element_size, size_t element_count, void* file) {
+	fwrite(data, element_size, element_count, (FILE*)file);
+}
+
+static int record(int argc, char** argv) {
+	size_t rom_size = 0;
+	char* rom = cnes_read_file(argv[2], &rom_size);
+	if (!rom) {
+		fprintf(stderr, "Failed to read %s\n", argv[2]);
+		return 1;
+	}
+
+	long frames = atol(argv[3]);
+	size_t input_size = 0;
+	uint8_t* input = NULL;
+	if (argc > 5) {
+		input = (uint8_t*)cnes_read_file(argv[5], &input_size);
+		if (!input) {
+			fprintf(stderr, "Failed to read %s\n", argv[5]);
+			return 1;
+		}
+	}
+
+	audio_mode = AUDIO_OFF;
+	video_output_enabled = false;
+	int loaded = cnes_check_ines(rom, rom_size);
+	if (loaded == CNES_LOAD_NO_ERR) loaded = load_ines(rom);
+	if (loaded != CNES_LOAD_NO_ERR) {
+		fprintf(stderr, loaded == CNES_LOAD_NOT_INES ? "Not an iNES file!\n" : "Mapper not supported!\n");
+		return 1;
+	}
+
+	FILE* out = fopen(argv[4], "wb");
+	if (!out) {
+		fprintf(stderr, "Failed to open %s\n", argv[4]);
+		return 1;
+	}
+
+	cnes_trace_to_stream(out, file_write);
+	for (long frame = 0; frame < frames; frame++) {
+		if ((size_t)frame * 2 + 1 < input_size) {
+			buttons_down[0] = input[frame * 2];
+			buttons_down[1] = input[frame * 2 + 1];
+		}
+		tick_frame();
+	}
+	cnes_trace_stop();
+
+	long size = ftell(out);
+	fclose(out);
+	printf("%zu instructions in %ld bytes\n", cnes_trace_count(), size);
+
+	free(input);
+	free(rom);
+	return 0;
+}
+
+static void print_record(const cnes_trace_record_t* record) {
+	char text[32];
+	uint8_t length = cnes_disassemble(record->pc, record->bytes, text, sizeof(text));
+
+	char bytes[12] = "";
+	for (uint8_t i = 0; i < length; i++) {
+		sprintf(bytes + strlen(bytes), i ? " %02X" : "%02X", record->bytes[i]);
+	}
+	printf("%04X  %-8s  %-14s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n",
+		record->pc, bytes, text, record->a, record->x, record->y, record->p, record->sp,
+		record->scanline, record->dot, (unsigned long long)record->cycle);
+}
+
+static int print(int argc, char** argv) {
+	FILE* f = fopen(argv[2], "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to read %s\n", argv[2]);
+		return 1;
+	}
+	unsigned long long first = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+	unsigned long long count = argc > 4 ? strtoull(argv[4], NULL, 10) : (unsigned long long)-1;
+
+	static cnes_trace_record_t records[CNES_TRACE_BLOCK_RECORDS];
+	uint8_t* block = NULL;
+	unsigned long long index = 0;
+	uint8_t header[8];
+	while (count > 0 && fread(header, 1, sizeof(header), f) == sizeof(header)) {
+		size_t length = header[4] | (header[5] << 8) | (header[6] << 16) | ((size_t)header[7] << 24);
+		uint8_t* grown = realloc(block, sizeof(header) + length);
+		if (!grown) break;
+		block = grown;
+		memcpy(block, header, sizeof(header));
+
+		size_t record_count;
+		if (fread(block + sizeof(header), 1, length, f) != length ||
+			!cnes_trace_unpack(block, sizeof(header) + length, records, &record_count)) {
+			fprintf(stderr, "%s is cut short or damaged after %llu instructions\n", argv[2], index);
+			break;
+		}
+
+		for (size_t i = 0; i < record_count && count > 0; i++, index++) {
+			if (index < first) continue;
+			print_record(&records[i]);
+			count--;
+		}
+	}
+
+	free(block);
+	fclose(f);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc >= 5 && strcmp(argv[1], "record") == 0) {
+		return record(argc, argv);
+	}
+	if (argc >= 3 && strcmp(argv[1], "print") == 0) {
+		return print(argc, argv);
+	}
+	fprintf(stderr, "usage: tracedump record <rom.nes> <frames> <out.trace> [input]\n");
+	fprintf(stderr, "       tracedump print <in.trace> [first] [count]\n");
+	fprintf(stderr, "  input holds two bytes per frame, one buttons_down byte for each controller\n");
+	return 1;
+}
@@ -92,31 +92,25 @@ GLuint load_shader_program_from_disk(const char* path) {
 
 // AUDIO STUFF
 //
-#define SAMPLE_RATE 15720
-#define BUFFER_LEN 262
+#define SAMPLE_RATE 44100
+#define BUFFER_LEN 735
 static int16_t* buffer = NULL;
 static size_t buffer_pos = 0;
-static int16_t sample_out = 0;
-static int last_scanline = -2; // Start out of range
 
-void write_audio_sample(int scanline, int16_t sample) {
-	// Super crude 1 pole IIR filter
-	sample_out += ((sample - sample_out) >> 4);
-
-	if (scanline == last_scanline) return;
-	last_scanline = scanline;
+static void queue_audio() {
+	for (;;) {
+		if (buffer == NULL) {
+			buffer = waveout_get_current_buffer();
+			buffer_pos = 0;
+		}
+		if (buffer == NULL) return; // Device is full, samples wait in the emulator
 
-	if (buffer == NULL) {
-		buffer = waveout_get_current_buffer();
-		buffer_pos = 0;
-	}
-	if (buffer != NULL) {
-		buffer[buffer_pos++] = sample_out;
+		size_t read = cnes_audio_read(&buffer[buffer_pos], BUFFER_LEN - buffer_pos);
+		buffer_pos += read;
+		if (buffer_pos < BUFFER_LEN) return;
 
-		if (buffer_pos == BUFFER_LEN) {
-			waveout_queue_buffer();
-			buffer = NULL;
-		}
+		waveout_queue_buffer();
+		buffer = NULL;
 	}
 }
 
@@ -238,6 +232,8 @@ DWORD WINAPI render_thread(void* param) {
 	int frame_counter = 0;
 	int num_frames = 0;
 
+	audio_mode = AUDIO_DECIMATED;
+	audio_sample_rate = SAMPLE_RATE;
 	waveout_initialize(SAMPLE_RATE, BUFFER_LEN);
 
 	QueryPerformanceCounter(&last);
@@ -275,6 +271,7 @@ DWORD WINAPI render_thread(void* param) {
 				num_frames++;
 				accum -= dt_cps;
 			}
+			queue_audio();
 
 			frame_counter++;
 			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 240, GL_RGB, GL_UNSIGNED_BYTE, framebuffer);
@@ -369,12 +366,17 @@ void load_ines_from_file(const char* path) {
 
 	fclose(f);
 
-	int result = load_ines(loaded_data);
+	int result = cnes_check_ines(loaded_data, (size_t)size);
+	if (result == CNES_LOAD_NO_ERR) result = load_ines(loaded_data);
 	switch (result) {
 		case CNES_LOAD_NO_ERR:
 			break;
 		case CNES_LOAD_MAPPER_NOT_SUPPORTED:
 			MessageBox(NULL, "Mapper not supported!", "Error", MB_ICONERROR);
+			exit(1);
+			break;
+		case CNES_LOAD_NOT_INES:
+			MessageBox(NULL, "Not an iNES file!", "Error", MB_ICONERROR);
 			[[fallthrough]];
 		default:
 			exit(1);